@@ -0,0 +1,161 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file arq.c
+ * @headerfile arq.h
+ * @brief Selective-repeat retransmission driven by ACK bitmaps on the reverse channel.
+ * @date 10-17-2026
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "arq.h"
+#include "bitvec.h"
+
+/**
+ * arq_init
+ * @brief Start with every packet unsent and unacknowledged.
+ * @param a ARQ state to initialize
+ * @param count Packets in the message
+ * @param rtt Epochs from sending a packet to reading the ACK that covers it
+ * @return 0 on success, -1 on failure
+ */
+int arq_init(struct arq *a, unsigned long count, long rtt) {
+    unsigned long i;
+
+    memset(a, 0, sizeof(*a));
+    a->acked = (uint64_t *) calloc(BITVEC_WORDS(count), sizeof(uint64_t));
+    a->sent = (long *) malloc(count * sizeof(long));
+    if (a->acked == NULL || a->sent == NULL) {
+        arq_free(a);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        a->sent[i] = -1;
+    }
+    a->count = count;
+    a->rtt = (rtt > 0) ? rtt : 1;
+
+    return 0;
+}
+
+/**
+ * arq_free
+ * @param a ARQ state to free
+ */
+void arq_free(struct arq *a) {
+    free(a->acked);
+    free(a->sent);
+    a->acked = NULL;
+    a->sent = NULL;
+}
+
+/**
+ * arq_build
+ * @brief Frame the packets due for sending, lowest first: those never sent, and those
+ *        still unacknowledged a round trip after they were last sent (NACKed or lost).
+ *        Packets whose ACK may still be on its way are not repeated.
+ * @param a ARQ state
+ * @param msg Message
+ * @param msglen Message bytes
+ * @param epoch Current epoch
+ * @param capacity Bytes available
+ * @param nbytes Set to the bytes used
+ * @return Buffer of packets (capacity bytes), NULL on error
+ */
+char *arq_build(struct arq *a, const char *msg, unsigned long msglen, long epoch,
+                unsigned long capacity, unsigned long *nbytes) {
+    unsigned long seq, len;
+    char *buf;
+
+    *nbytes = 0;
+    a->lastsent = 0;
+    a->lastresent = 0;
+    buf = (char *) calloc(capacity + 1, 1);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    for (seq = 0; seq < a->count; seq++) {
+        if (bitvec_get(a->acked, seq) || (a->sent[seq] >= 0 && epoch - a->sent[seq] < a->rtt)) {
+            continue;
+        }
+
+        len = packet_put(buf + *nbytes, capacity - *nbytes, msg, msglen, seq);
+        if (len == 0) {
+            break;
+        }
+
+        a->lastresent += (a->sent[seq] >= 0);
+        a->lastsent++;
+        a->sent[seq] = epoch;
+        *nbytes += len;
+    }
+    a->resent += a->lastresent;
+
+    return buf;
+}
+
+/**
+ * arq_ack
+ * @brief Build the Receiver's ACK from the packets it holds.
+ * @param rx Receive state
+ * @param ack Output, ARQ_ACK_BYTES bytes
+ * @return ACK bytes, 0 before any packet has arrived
+ */
+unsigned long arq_ack(const struct packet_rx *rx, char *ack) {
+    unsigned long base, i;
+
+    if (rx->count == 0) {
+        return 0;
+    }
+
+    for (base = 0; base < rx->count && bitvec_get(rx->have, base); base++);
+
+    memset(ack, 0, ARQ_ACK_BYTES);
+    ack[0] = rx->count >> 8;
+    ack[1] = rx->count;
+    ack[2] = base >> 8;
+    ack[3] = base;
+    for (i = 0; i < ARQ_WINDOW && base + i < rx->count; i++) {
+        if (bitvec_get(rx->have, base + i)) {
+            ack[4 + i / 8] |= 0x80 >> (i % 8);
+        }
+    }
+
+    return ARQ_ACK_BYTES;
+}
+
+/**
+ * arq_apply
+ * @brief Mark the packets an ACK confirms.
+ * @param a ARQ state
+ * @param ack ACK from the Receiver
+ * @param len ACK bytes
+ * @return Packets newly confirmed
+ */
+unsigned long arq_apply(struct arq *a, const char *ack, unsigned long len) {
+    const uint8_t *p = (const uint8_t *) ack;
+    unsigned long count, base, seq, nnew = 0;
+
+    if (len < ARQ_ACK_BYTES) {
+        return 0;
+    }
+
+    count = ((unsigned long) p[0] << 8) | p[1];
+    base = ((unsigned long) p[2] << 8) | p[3];
+    if (count != a->count || base > count) {
+        return 0;
+    }
+
+    for (seq = 0; seq < count && seq < base + ARQ_WINDOW; seq++) {
+        if (!bitvec_get(a->acked, seq) && (seq < base || ((p[4 + (seq - base) / 8] << ((seq - base) % 8)) & 0x80))) {
+            bitvec_assign(a->acked, seq, 1);
+            nnew++;
+        }
+    }
+    a->nacked += nnew;
+
+    return nnew;
+}
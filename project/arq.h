@@ -0,0 +1,43 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file arq.h
+ * @brief Selective-repeat retransmission driven by ACK bitmaps on the reverse channel.
+ * @date 10-17-2026
+ */
+#ifndef _ARQ_H_
+#define _ARQ_H_
+
+#include <stdint.h>
+
+#include "packet.h"
+
+/*
+ * ACK message, sent as a single packet:
+ *   count[2] base[2] bitmap[ARQ_WINDOW / 8]
+ * Every packet below base has arrived; bitmap bit i (MSB first) acknowledges packet
+ * base + i, and a clear bit is a NACK for it.
+ */
+#define ARQ_WINDOW    256
+#define ARQ_ACK_BYTES (4 + ARQ_WINDOW / 8)
+#define ARQ_KEY       0x41434b4e41434b21ULL  /* Keys the reverse frames apart from the forward ones */
+
+struct arq {
+    unsigned long count;          /* Packets in the message */
+    uint64_t *acked;              /* Packets the Receiver has confirmed */
+    long *sent;                   /* Epoch each packet was last sent, -1 if never */
+    long rtt;                     /* Epochs from sending a packet to reading its ACK */
+    unsigned long nacked;         /* Packets confirmed */
+    unsigned long resent;         /* Retransmissions in total */
+    unsigned long lastsent;       /* Packets in the last frame built */
+    unsigned long lastresent;     /* ...of which retransmissions */
+};
+
+int arq_init(struct arq *a, unsigned long count, long rtt);
+void arq_free(struct arq *a);
+char *arq_build(struct arq *a, const char *msg, unsigned long msglen, long epoch,
+                unsigned long capacity, unsigned long *nbytes);
+unsigned long arq_ack(const struct packet_rx *rx, char *ack);
+unsigned long arq_apply(struct arq *a, const char *ack, unsigned long len);
+
+#endif
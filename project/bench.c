@@ -0,0 +1,308 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file bench.c
+ * @brief Benchmark harness for memdupe: probe cost, encode/decode and load throughput,
+ *        and bit error rate and goodput of a full round against the KSM emulator.
+ *        Results are printed as one JSON object for regression tracking.
+ * @date 10-17-2026
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "channel.h"
+#include "timer.h"
+#include "classify.h"
+#include "bitvec.h"
+#include "carrier.h"
+#include "hugepage.h"
+
+#define BENCH_PAGES   16384     /* Carrier for the probe and load benchmarks */
+#define BENCH_REPS    10
+#define BENCH_CHANNEL 4096      /* Carrier for the channel round */
+#define BENCH_PENALTY 20000     /* Emulated COW penalty (ns) */
+#define BENCH_SEED    0x5eed
+#define BENCH_TEXT    (1 << 20) /* Message size for encode/decode (bytes) */
+
+static struct memdupe_config _cfg;
+static struct memdupe_channel _ch;
+static int _stdout = -1;
+
+/**
+ * bench_quiet
+ * @brief Send memdupe's own progress output to /dev/null while a benchmark runs.
+ * @param on True to silence stdout, false to restore it
+ */
+static void bench_quiet(int on) {
+    int null;
+
+    fflush(stdout);
+    if (on && _stdout < 0) {
+        _stdout = dup(STDOUT_FILENO);
+        null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    } else if (!on && _stdout >= 0) {
+        dup2(_stdout, STDOUT_FILENO);
+        close(_stdout);
+        _stdout = -1;
+    }
+}
+
+/**
+ * bench_now
+ * @return CLOCK_MONOTONIC_RAW time (ns)
+ */
+static ulong bench_now(void) {
+    return timer_clock(CLOCK_MONOTONIC_RAW);
+}
+
+/**
+ * bench_probe
+ * @brief Best-of-reps cost of the bare probe loop and of a whole write_pages step.
+ * @param pages Carrier size
+ * @param reps Repetitions
+ * @param probe_ns Set to ns per page of probe_stripe
+ * @param write_ns Set to wall-clock ns per page of write_pages (mask, probe, classify, trace)
+ */
+static void bench_probe(ulong pages, int reps, double *probe_ns, double *write_ns) {
+    char *data;
+    uint64_t *mask;
+    ulong best_probe = ~0UL, best_write = ~0UL, t;
+    int r;
+
+    data = carrier_generate(BENCH_SEED, pages, MY_PAGE_SIZE);
+    mask = (uint64_t *) calloc(BITVEC_WORDS(pages), sizeof(uint64_t));
+    memset(mask, 0xff, BITVEC_WORDS(pages) * sizeof(uint64_t));
+    probe_init(&_ch.probe, pages, MY_PAGE_SIZE);
+    trace_init(&_ch.trace, 0);
+
+    _cfg.role = TESTER;
+    for (r = 0; r < reps; r++) {
+        probe_prefault(&_ch.probe, data, 0, pages);
+        t = timer_to_ns(probe_stripe(&_ch.probe, data, mask, 0, pages));
+        best_probe = (t < best_probe) ? t : best_probe;
+
+        t = bench_now();
+        write_pages(&_ch, &data, pages, 1);
+        t = bench_now() - t;
+        best_write = (t < best_write) ? t : best_write;
+    }
+
+    *probe_ns = (double) best_probe / pages;
+    *write_ns = (double) best_write / pages;
+
+    probe_free(&_ch.probe);
+    free(mask);
+    munmap(data, pages * MY_PAGE_SIZE);
+}
+
+/**
+ * bench_codec
+ * @brief Throughput of encode_message and decode_message on a large printable message.
+ * @param reps Repetitions
+ * @param encode_mbs Set to encode MB/s
+ * @param decode_mbs Set to decode MB/s
+ */
+static void bench_codec(int reps, double *encode_mbs, double *decode_mbs) {
+    struct xoshiro rng;
+    char *text, *msg;
+    uint64_t *bits;
+    ulong nbits, t, tenc = 0, tdec = 0;
+    int i, r;
+
+    text = (char *) malloc(BENCH_TEXT + 1);
+    carrier_seed(&rng, BENCH_SEED);
+    for (i = 0; i < BENCH_TEXT; i++) {
+        text[i] = 'A' + carrier_next(&rng) % 26;
+    }
+    text[BENCH_TEXT] = '\0';
+
+    for (r = 0; r < reps; r++) {
+        t = bench_now();
+        bits = encode_message(text, BENCH_TEXT, &nbits);
+        tenc += bench_now() - t;
+
+        t = bench_now();
+        msg = decode_message(bits, nbits);
+        tdec += bench_now() - t;
+
+        free(msg);
+        free(bits);
+    }
+
+    *encode_mbs = (double) BENCH_TEXT * reps * 1000 / tenc;
+    *decode_mbs = (double) BENCH_TEXT * reps * 1000 / tdec;
+    free(text);
+}
+
+/**
+ * bench_load
+ * @brief Throughput of load_file for a generated carrier and for a real file.
+ * @param pages Generated carrier size
+ * @param path File to load
+ * @param synth_mbs Set to MB/s for the generated carrier
+ * @param file_mbs Set to MB/s for the file (0 if it cannot be loaded)
+ */
+static void bench_load(ulong pages, const char *path, double *synth_mbs, double *file_mbs) {
+    char synth[64];
+    char *data;
+    ulong fsize, t;
+
+    snprintf(synth, sizeof(synth), "%s%d:%ld", CARRIER_PREFIX, BENCH_SEED, pages);
+    t = bench_now();
+    data = load_file(synth, &fsize);
+    t = bench_now() - t;
+    *synth_mbs = (data != NULL) ? (double) fsize * 1000 / t : 0;
+    if (data != NULL) {
+        munmap(data, fsize);
+    }
+
+    t = bench_now();
+    data = load_file(path, &fsize);
+    t = bench_now() - t;
+    *file_mbs = (data != NULL) ? (double) fsize * 1000 / t : 0;
+    if (data != NULL) {
+        munmap(data, fsize);
+    }
+}
+
+/**
+ * bench_channel
+ * @brief One Sender/Receiver round inside this process, with both carriers in the KSM
+ *        emulator: bit error rate of the raw channel bits and goodput of the round.
+ * @param pages Carrier size
+ * @param penalty Emulated COW penalty (ns)
+ * @param ber Set to the bit error rate
+ * @param goodput Set to data bits per second of the round, discounted by the bit error rate
+ * @param conf Set to the classifier's mean confidence (per mille)
+ * @return 0 on success, -1 if the emulator is unavailable
+ */
+static int bench_channel(ulong pages, long penalty, double *ber, double *goodput, uint *conf) {
+    struct xoshiro rng;
+    char synth[64];
+    char *sender, *receiver;
+    char *packets;
+    uint64_t *bits, *expect;
+    const struct trace_rec *rec;
+    ulong fsize, nbits, nbytes, seq = 0, i, errors = 0, t;
+    ulong nchars = fec_capacity(_cfg.fecmode, pages) / BYTEBITS;
+    ulong confsum = 0;
+
+    if (ksmemu_init(&_ch.ksmemu, penalty, MY_PAGE_SIZE) < 0) {
+        return -1;
+    }
+
+    /* A random printable message that fills the carrier */
+    carrier_seed(&rng, BENCH_SEED);
+    _cfg.message = (char *) malloc(nchars + 1);
+    _cfg.msglen = nchars;
+    for (i = 0; i < nchars; i++) {
+        _cfg.message[i] = 'a' + carrier_next(&rng) % 26;
+    }
+    _cfg.message[nchars] = '\0';
+
+    /* The channel bits the Sender will write: its packets, after FEC */
+    packets = packet_build(_cfg.message, nchars, &seq, nchars, &nbytes);
+    bits = encode_message(packets, nbytes, &nbits);
+    expect = (uint64_t *) calloc(BITVEC_WORDS(pages), sizeof(uint64_t));
+    fec_encode(_cfg.fecmode, bits, nbits, expect, pages);
+    free(packets);
+
+    snprintf(synth, sizeof(synth), "%s%d:%ld", CARRIER_PREFIX, BENCH_SEED, pages);
+    sender = load_file(synth, &fsize);
+    sender = ksmemu_adopt(&_ch.ksmemu, sender, fsize);
+    receiver = load_file(synth, &fsize);
+    receiver = ksmemu_adopt(&_ch.ksmemu, receiver, fsize);
+    probe_init(&_ch.probe, pages, MY_PAGE_SIZE);
+    trace_init(&_ch.trace, pages);
+
+    t = bench_now();
+    _cfg.role = SENDER;
+    _ch.seq = 0;
+    write_pages(&_ch, &sender, pages, 1);
+
+    ksm_wait(&_ch);
+
+    _cfg.role = RECEIVER;
+    _ch.trace.head = 0;
+    write_pages(&_ch, &receiver, pages, 2);
+    t = bench_now() - t;
+
+    /* The trace holds the Receiver's classification of every page */
+    for (i = 0; i < _ch.trace.head && i < pages; i++) {
+        rec = &_ch.trace.ring[i];
+        errors += (bitvec_get(expect, rec->index) != !rec->islong);
+        confsum += rec->conf;
+    }
+
+    *ber = (double) errors / pages;
+    *goodput = (double) _ch.fecstats.databits * (1.0 - *ber) * BILLION / t;
+    *conf = confsum / pages;
+
+    trace_free(&_ch.trace);
+    probe_free(&_ch.probe);
+    ksmemu_free(&_ch.ksmemu);
+    packet_rx_free(&_ch.rx);
+    munmap(sender, fsize);
+    munmap(receiver, fsize);
+    free(expect);
+    free(bits);
+    free(_cfg.message);
+
+    return 0;
+}
+
+/**
+ * Main function
+ * @param argc Arg count
+ * @param argv Arguments: PAGES REPS KSMEMU FEC FILEPATH
+ * @return Exit status
+ */
+int main(int argc, char **argv) {
+    ulong pages = (argc > 1) ? atol(argv[1]) : BENCH_PAGES;
+    int reps = (argc > 2) ? atoi(argv[2]) : BENCH_REPS;
+    long penalty = (argc > 3) ? atol(argv[3]) : BENCH_PENALTY;
+    double probe_ns, write_ns, encode_mbs, decode_mbs, synth_mbs, file_mbs, ber = -1, goodput = 0;
+    uint conf = 0;
+    int timer, channel;
+
+    _cfg.fecmode = (argc > 4) ? atoi(argv[4]) : FEC_NONE;
+    _ch.cfg = &_cfg;
+    _cfg.classifier = CLASS_OTSU;
+    _cfg.ksmthresh = KSM_THRESHOLD;
+    _cfg.sleeptime = NUM_SECONDS;
+    hugepage_init(HUGE_DEFAULT);
+    timer = timer_init(TIMER_AUTO);
+
+    bench_quiet(TRUE);
+    bench_probe(pages, reps, &probe_ns, &write_ns);
+    bench_codec(reps, &encode_mbs, &decode_mbs);
+    bench_load(pages, (argc > 5) ? argv[5] : argv[0], &synth_mbs, &file_mbs);
+    channel = bench_channel(BENCH_CHANNEL, penalty, &ber, &goodput, &conf);
+    bench_quiet(FALSE);
+
+    printf("{\n");
+    printf("  \"timer\": \"%s\",\n", timer_name(timer));
+    printf("  \"timer_overhead_ticks\": %lu,\n", (ulong) timer_overhead());
+    printf("  \"pages\": %ld,\n", pages);
+    printf("  \"probe_ns_per_page\": %.2f,\n", probe_ns);
+    printf("  \"write_pages_ns_per_page\": %.2f,\n", write_ns);
+    printf("  \"encode_mb_s\": %.1f,\n", encode_mbs);
+    printf("  \"decode_mb_s\": %.1f,\n", decode_mbs);
+    printf("  \"load_synth_mb_s\": %.1f,\n", synth_mbs);
+    printf("  \"load_file_mb_s\": %.1f,\n", file_mbs);
+    printf("  \"channel\": {\"ok\": %s, \"pages\": %d, \"fec\": \"%s\", \"penalty_ns\": %ld, "
+           "\"ber\": %.6f, \"goodput_bits_s\": %.1f, \"confidence_permille\": %u}\n",
+           (channel == 0) ? "true" : "false", BENCH_CHANNEL, fec_name(_cfg.fecmode), penalty, ber, goodput, conf);
+    printf("}\n");
+
+    return (channel == 0) ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file bitvec.h
+ * @brief Packed bit vectors for covert channel messages (one bit per page).
+ *        Header-only so kmemdupe and the user tool share one encoding.
+ * @date 10-17-2026
+ */
+#ifndef _BITVEC_H_
+#define _BITVEC_H_
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#else
+#include <stdint.h>
+#include <string.h>
+#endif
+
+#define BITVEC_WORD_BITS  64
+#define BITVEC_WORD_BYTES 8
+
+/* Number of 64-bit words needed to hold n bits */
+#define BITVEC_WORDS(n) (((n) + BITVEC_WORD_BITS - 1) / BITVEC_WORD_BITS)
+
+/**
+ * bitvec_get
+ * @param v Bit vector
+ * @param i Bit index
+ * @return Bit i of v
+ */
+static inline int bitvec_get(const uint64_t *v, unsigned long i) {
+    return (v[i / BITVEC_WORD_BITS] >> (i % BITVEC_WORD_BITS)) & 1;
+}
+
+/**
+ * bitvec_assign
+ * @brief Set bit i of v to bit.
+ * @param v Bit vector
+ * @param i Bit index
+ * @param bit New value (0 or 1)
+ */
+static inline void bitvec_assign(uint64_t *v, unsigned long i, int bit) {
+    uint64_t mask = (uint64_t) 1 << (i % BITVEC_WORD_BITS);
+
+    if (bit) {
+        v[i / BITVEC_WORD_BITS] |= mask;
+    } else {
+        v[i / BITVEC_WORD_BITS] &= ~mask;
+    }
+}
+
+/**
+ * bitvec_rev8
+ * @brief Reverse the bit order inside each byte of a word, so that the byte-wise
+ *        MSB-first wire order maps onto LSB-first bit indices.
+ * @param w Word
+ * @return Word with every byte bit-reversed
+ */
+static inline uint64_t bitvec_rev8(uint64_t w) {
+    w = ((w >> 1) & 0x5555555555555555ULL) | ((w & 0x5555555555555555ULL) << 1);
+    w = ((w >> 2) & 0x3333333333333333ULL) | ((w & 0x3333333333333333ULL) << 2);
+    w = ((w >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((w & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return w;
+}
+
+/**
+ * bitvec_pack
+ * @brief Pack bytes into bits, MSB of each byte first, a word at a time.
+ * @param v Bit vector of BITVEC_WORDS(nbytes * 8) words
+ * @param bytes Bytes to pack
+ * @param nbytes Number of bytes
+ */
+static inline void bitvec_pack(uint64_t *v, const char *bytes, unsigned long nbytes) {
+    unsigned long i, nwords = nbytes / BITVEC_WORD_BYTES;
+    unsigned long tail = nbytes % BITVEC_WORD_BYTES;
+    uint64_t w;
+
+    for (i = 0; i < nwords; i++) {
+        memcpy(&w, bytes + i * BITVEC_WORD_BYTES, BITVEC_WORD_BYTES);
+        v[i] = bitvec_rev8(w);
+    }
+
+    if (tail) {
+        w = 0;
+        memcpy(&w, bytes + nwords * BITVEC_WORD_BYTES, tail);
+        v[nwords] = bitvec_rev8(w);
+    }
+}
+
+/**
+ * bitvec_unpack
+ * @brief Unpack bits into bytes, the inverse of bitvec_pack.
+ * @param bytes Output bytes
+ * @param v Bit vector
+ * @param nbytes Number of bytes to unpack
+ */
+static inline void bitvec_unpack(char *bytes, const uint64_t *v, unsigned long nbytes) {
+    unsigned long i, nwords = nbytes / BITVEC_WORD_BYTES;
+    unsigned long tail = nbytes % BITVEC_WORD_BYTES;
+    uint64_t w;
+
+    for (i = 0; i < nwords; i++) {
+        w = bitvec_rev8(v[i]);
+        memcpy(bytes + i * BITVEC_WORD_BYTES, &w, BITVEC_WORD_BYTES);
+    }
+
+    if (tail) {
+        w = bitvec_rev8(v[nwords]);
+        memcpy(bytes + nwords * BITVEC_WORD_BYTES, &w, tail);
+    }
+}
+
+#endif
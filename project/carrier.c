@@ -0,0 +1,151 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file carrier.c
+ * @headerfile carrier.h
+ * @brief Deterministic synthetic carrier pages generated from a shared seed.
+ *        Sender and receiver derive identical pages without any carrier file, and
+ *        every page is unique so KSM never merges a process's pages with each other.
+ * @date 10-17-2026
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "carrier.h"
+#include "hugepage.h"
+
+#define GOLDEN_GAMMA 0x9e3779b97f4a7c15ULL
+
+/**
+ * splitmix64
+ * @brief Advance a splitmix64 state; used to expand seeds into xoshiro state.
+ * @param x State
+ * @return Next output
+ */
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += GOLDEN_GAMMA);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * rotl
+ * @return x rotated left by k bits
+ */
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * carrier_seed
+ * @brief Seed a xoshiro256** generator.
+ * @param rng Generator
+ * @param seed Seed
+ */
+void carrier_seed(struct xoshiro *rng, uint64_t seed) {
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        rng->s[i] = splitmix64(&seed);
+    }
+}
+
+/**
+ * carrier_next
+ * @brief Next xoshiro256** output.
+ * @param rng Generator
+ * @return 64 random bits
+ */
+uint64_t carrier_next(struct xoshiro *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+/**
+ * carrier_parse
+ * @brief Recognize a synthetic carrier path of the form synth:SEED[:PAGES].
+ * @param path FILEPATH argument
+ * @param seed Set to the seed
+ * @param pages Set to the number of pages (CARRIER_PAGES if omitted)
+ * @return True if path names a synthetic carrier
+ */
+int carrier_parse(const char *path, uint64_t *seed, unsigned long *pages) {
+    char *end;
+
+    if (strncmp(path, CARRIER_PREFIX, strlen(CARRIER_PREFIX)) != 0) {
+        return 0;
+    }
+
+    *seed = strtoull(path + strlen(CARRIER_PREFIX), &end, 0);
+    *pages = (*end == ':') ? strtoul(end + 1, NULL, 0) : CARRIER_PAGES;
+
+    return 1;
+}
+
+/**
+ * carrier_fill
+ * @brief Fill pages with content derived from (seed, page index). Each page has its own
+ *        generator, so any page range can be regenerated independently; the first word
+ *        holds the page index, which keeps every page distinct.
+ * @param data Base of the carrier
+ * @param first First page to fill
+ * @param count Number of pages to fill
+ * @param pagesize Bytes per page
+ * @param seed Carrier seed
+ */
+void carrier_fill(char *data, unsigned long first, unsigned long count, size_t pagesize, uint64_t seed) {
+    struct xoshiro rng;
+    uint64_t *word;
+    unsigned long page;
+    size_t i;
+
+    for (page = first; page < first + count; page++) {
+        word = (uint64_t *) (data + page * pagesize);
+        carrier_seed(&rng, seed ^ (page * GOLDEN_GAMMA));
+
+        word[0] = page;
+        for (i = 1; i < pagesize / sizeof(uint64_t); i++) {
+            word[i] = carrier_next(&rng);
+        }
+    }
+}
+
+/**
+ * carrier_generate
+ * @brief Allocate a private, KSM-mergeable region and fill it from the seed.
+ * @param seed Carrier seed
+ * @param pages Number of pages
+ * @param pagesize Bytes per page
+ * @return Pointer to the carrier, NULL on error
+ */
+char *carrier_generate(uint64_t seed, unsigned long pages, size_t pagesize) {
+    char *data;
+
+    data = (char *) mmap(NULL, pages * pagesize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (data == MAP_FAILED) {
+        printf("<memdupe> Error allocating carrier: %ld pages\n", pages);
+        return NULL;
+    }
+
+    hugepage_channel(data, pages * pagesize);
+    carrier_fill(data, 0, pages, pagesize, seed);
+
+    if (madvise(data, pages * pagesize, MADV_MERGEABLE) < 0) {
+        printf("<memdupe> Warning: madvise(MADV_MERGEABLE) failed on carrier\n");
+    }
+
+    return data;
+}
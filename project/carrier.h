@@ -0,0 +1,27 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file carrier.h
+ * @brief Deterministic synthetic carrier pages generated from a shared seed.
+ * @date 10-17-2026
+ */
+#ifndef _CARRIER_H_
+#define _CARRIER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CARRIER_PREFIX "synth:"   /* FILEPATH=synth:SEED[:PAGES] selects a generated carrier */
+#define CARRIER_PAGES  4096       /* Default generated carrier size (pages) */
+
+struct xoshiro {
+    uint64_t s[4];
+};
+
+void carrier_seed(struct xoshiro *rng, uint64_t seed);
+uint64_t carrier_next(struct xoshiro *rng);
+int carrier_parse(const char *path, uint64_t *seed, unsigned long *pages);
+void carrier_fill(char *data, unsigned long first, unsigned long count, size_t pagesize, uint64_t seed);
+char *carrier_generate(uint64_t seed, unsigned long pages, size_t pagesize);
+
+#endif
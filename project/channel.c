@@ -0,0 +1,432 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file channel.c
+ * @headerfile channel.h
+ * @brief One covert channel instance: carrier loading, the probe round and message coding.
+ *        memdupe and the bench harness both drive a channel through these functions.
+ * @date 10-17-2026
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "channel.h"
+#include "timer.h"
+#include "classify.h"
+#include "bitvec.h"
+#include "carrier.h"
+#include "hugepage.h"
+
+/**
+ * read_file
+ * @brief Read a whole file into a buffer, retrying short reads and interrupted calls.
+ * @param fd Open file descriptor
+ * @param data Destination buffer
+ * @param size Number of bytes to read
+ * @return TRUE if every byte was read
+ */
+static int read_file(int fd, char *data, ulong size) {
+    ssize_t nread;
+    ulong done = 0;
+
+    while (done < size) {
+        nread = read(fd, data + done, size - done);
+        if (nread < 0 && errno == EINTR) {
+            continue;
+        } else if (nread <= 0) {
+            return FALSE;
+        }
+        done += nread;
+    }
+
+    return TRUE;
+}
+
+/**
+ * load_file
+ * @brief Load file into private anonymous memory that KSM can merge. The file is mapped
+ *        MAP_PRIVATE with MAP_POPULATE, which breaks COW on every page inside the kernel
+ *        (one copy from the page cache, no read() copy or zero-fill). If the file cannot
+ *        be mapped, it is read() into an anonymous mapping instead. A path of the form
+ *        synth:SEED[:PAGES] generates the carrier from the seed with no file at all.
+ * @param path Path of file to load
+ * @param fsize Pointer to file size
+ * @return Pointer to the buffer containing the file, NULL on error
+ */
+char *load_file(const char *path, ulong *fsize) {
+    char *data = NULL;
+    int fd;
+    struct stat st;
+    uint64_t seed;
+    ulong npages;
+
+    // Generate a synthetic carrier
+    if (carrier_parse(path, &seed, &npages)) {
+        printf("<memdupe> Generating carrier: %ld pages from seed %ld\n", npages, seed);
+        data = carrier_generate(seed, npages, MY_PAGE_SIZE);
+        *fsize = (data != NULL) ? npages * MY_PAGE_SIZE : 0;
+        return data;
+    }
+
+    // Open the file
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        printf("<memdupe> Error opening file: '%s'\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        *fsize = 0;
+        return NULL;
+    }
+
+    /* Get file size */
+    *fsize = st.st_size;
+    printf("<memdupe> Reading file: '%s'\n", path);
+
+    // Map a private, pre-populated copy of the file
+    data = (char *) mmap(NULL, *fsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+
+    if (data != MAP_FAILED) {
+        hugepage_channel(data, *fsize);
+    } else {
+        // Fall back to reading into a private anonymous mapping (KSM ignores MAP_SHARED memory)
+        data = (char *) mmap(NULL, *fsize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+        if (data == MAP_FAILED) {
+            printf("<memdupe> Error allocating data: %ld bytes\n", *fsize);
+            data = NULL;
+        } else {
+            hugepage_channel(data, *fsize);
+            if (!read_file(fd, data, *fsize)) {
+                printf("<memdupe> Error reading file: '%s'\n", path);
+                munmap(data, *fsize);
+                data = NULL;
+            }
+        }
+    }
+
+    // Indicate that the buffer can be merged by KSM
+    if (data != NULL && madvise(data, *fsize, MADV_MERGEABLE) < 0) {
+        printf("<memdupe> Warning: madvise(MADV_MERGEABLE) failed: %s\n", strerror(errno));
+    }
+
+    if (data == NULL) {
+        *fsize = 0;
+    }
+
+    // Close file
+    close(fd);
+
+    return data;
+}
+
+/**
+ * write_pages
+ * @brief Probe every page with one batched stripe, then classify the timings. On the
+ *        reverse channel the roles swap: the Receiver writes an ACK in step 1 and the
+ *        Sender reads it back in step 2.
+ * @param ch Channel
+ * @param data Pointer to the file data in memory
+ * @param pages Number of pages occupied by the file
+ * @param step Step indicates whether first write or second
+ * @return Clock time required to write pages (ns)
+ */
+ulong write_pages(struct memdupe_channel *ch, char** data, ulong pages, uint step) {
+    const struct memdupe_config *cfg = ch->cfg;
+    char *msg = NULL;
+    uint64_t *bits = NULL;
+    uint64_t *mask = NULL;
+    uint64_t *payload = NULL;
+    uint8_t *islong = NULL;
+    uint16_t *conf = NULL;
+    uint64_t *scratch = NULL;
+    char *packets = NULL;
+    char ack[ARQ_ACK_BYTES + RATE_ACK_BYTES];
+    ulong nbits = 0;
+    ulong nbytes = 0;
+    ulong count, first, bad, capacity;
+    ulong index = 0;
+    ulong ttotal = 0;
+    struct classify cls = {0};
+    int op, outcome;
+
+    /* Build the per-page write mask before timing anything */
+    mask = (uint64_t *) hugepage_alloc(BITVEC_WORDS(pages) * sizeof(uint64_t));
+    if (mask == NULL) {
+        printf("<memdupe> Error allocating write mask: %ld pages\n", pages);
+        return 0;
+    }
+
+    if (step == 1 && cfg->role != TESTER) {
+        capacity = fec_capacity(cfg->fecmode, pages) / BYTEBITS;
+        if (cfg->role == SENDER && ch->rate.pages > 0 && ch->rate.pages < pages) {
+            /* Fill only the pages the Receiver's budget allows; the rest encode to zeros */
+            capacity = fec_capacity(cfg->fecmode, ch->rate.pages) / BYTEBITS;
+        }
+        if (cfg->role == SENDER && ch->arq.acked != NULL) {
+            /* Frame the packets selective repeat says are due */
+            packets = arq_build(&ch->arq, cfg->message, cfg->msglen, ch->epoch, capacity, &nbytes);
+            if (nbytes == 0 && capacity < PACKET_OVERHEAD + ((cfg->msglen < PACKET_PAYLOAD) ? cfg->msglen : PACKET_PAYLOAD)) {
+                printf("<memdupe> Warning: %ld pages cannot hold a packet\n", pages);
+            }
+        } else if (cfg->role == SENDER) {
+            /* Frame the next packets of the message */
+            count = packet_count(cfg->msglen);
+            first = ch->seq;
+            packets = packet_build(cfg->message, cfg->msglen, &ch->seq, capacity, &nbytes);
+            if (ch->seq == first) {
+                printf("<memdupe> Warning: %ld pages cannot hold a packet\n", pages);
+            } else if (ch->seq < count && cfg->nframes == 0) {
+                printf("<memdupe> Warning: message truncated to %ld of %ld packets\n", ch->seq, count);
+            }
+        } else {
+            /* The Receiver's ACK is one packet on the reverse channel, none before the first packet arrives */
+            first = 0;
+            count = arq_ack(&ch->rx, ack);
+            if (count > 0 && cfg->adapt) {
+                count += rate_put(&ch->rate, ack + count);
+            }
+            packets = packet_build(ack, count, &first, (count > 0) ? capacity : 0, &nbytes);
+        }
+
+        /* Encode the packets (bytes => bits) */
+        bits = encode_message(packets, nbytes, &nbits);
+        free(packets);
+
+        /* Optional FEC stage between the encoder and the page writes */
+        fec_encode(cfg->fecmode, bits, nbits, mask, pages);
+        free(bits);
+    } else {
+        /* Write every page to probe it */
+        for (index = 0; index < pages; index++) {
+            bitvec_assign(mask, index, 1);
+        }
+    }
+
+    /* Pre-fault the stripe(s), then time every write into the probe array */
+    if (ch->pool.workers != NULL) {
+        ttotal = worker_probe(&ch->pool, &ch->probe, *data, mask, pages);
+    } else if (ch->noise.region != NULL) {
+        ttotal = noise_probe(&ch->noise, &ch->probe, *data, mask, pages);
+    } else {
+        probe_prefault(&ch->probe, *data, 0, pages);
+        ttotal = probe_stripe(&ch->probe, *data, mask, 0, pages);
+    }
+
+    /* Statistics run after the timed region, over the whole timing vector */
+    islong = (uint8_t *) hugepage_alloc(pages);
+    conf = (uint16_t *) hugepage_alloc(pages * sizeof(uint16_t));
+    scratch = (uint64_t *) hugepage_alloc(CLASS_SCRATCH(pages) * sizeof(uint64_t));
+    if (step > 1 && cfg->role != TESTER) {
+        payload = (uint64_t *) hugepage_alloc(BITVEC_WORDS(pages) * sizeof(uint64_t));
+    }
+
+    if (islong == NULL || conf == NULL || scratch == NULL || (step > 1 && cfg->role != TESTER && payload == NULL)) {
+        printf("<memdupe> Error allocating classifier state: %ld pages\n", pages);
+        hugepage_free(payload, BITVEC_WORDS(pages) * sizeof(uint64_t));
+        hugepage_free(scratch, CLASS_SCRATCH(pages) * sizeof(uint64_t));
+        hugepage_free(conf, pages * sizeof(uint16_t));
+        hugepage_free(islong, pages);
+        hugepage_free(mask, BITVEC_WORDS(pages) * sizeof(uint64_t));
+        return 0;
+    }
+
+    cls.method = cfg->classifier;
+    cls.k = cfg->ksmthresh;
+    classify_run(&cls, ch->probe.ticks, pages, islong, conf, scratch);
+    if (step > 1 && ch->noise.region != NULL) {
+        noise_filter(&ch->noise, &ch->probe, *data, &cls, islong, conf, pages);
+    }
+
+    /* Decode the timings and record every page written in the trace */
+    op = (step > 1) ? TRACE_READ : (cfg->role != TESTER) ? TRACE_WRITE : TRACE_TIME;
+    for (index = 0; index < pages; index++) {
+        if (op == TRACE_WRITE && !bitvec_get(mask, index)) {
+            continue;
+        }
+
+        trace_record(&ch->trace, op, ch->round, index, ch->probe.ticks[index], islong[index], conf[index]);
+        if (step > 1) {
+            // If write time is long, COW means page has been deduplicated by receier
+            bitvec_assign(mask, index, !islong[index]);
+        }
+    }
+    ch->round++;
+
+    if (step > 1) {
+        printf("<memdupe> Classifier %s: threshold %ld ns, %ld of %ld pages long, "
+               "confidence %u.%u%%, %ld weak bits\n",
+               classify_name(cls.method), timer_to_ns(cls.threshold), cls.nlong, pages,
+               cls.conf / 10, cls.conf % 10, cls.nweak);
+
+        if (ch->pool.workers != NULL) {
+            worker_report(&ch->pool, &ch->probe, cls.threshold, cls.median);
+        }
+
+        if (ch->noise.region != NULL) {
+            printf("<memdupe> Noise: floor %ld ns (%ld%% of calibration), %ld of %ld windows disturbed%s%s%s, "
+                   "%ld long pages written again, %ld cleared\n",
+                   timer_to_ns(ch->noise.current), ch->noise.current * 100 / ch->noise.floor,
+                   ch->noise.ndisturbed, ch->noise.windows,
+                   (ch->noise.sources & NOISE_IRQ) ? " (interrupts)" : "",
+                   (ch->noise.sources & NOISE_PREEMPT) ? " (preemption)" : "",
+                   (ch->noise.sources & NOISE_MIGRATE) ? " (migration)" : "",
+                   ch->noise.reprobed, ch->noise.cleared);
+            if (ch->noise.current * 100 >= ch->noise.floor * NOISE_DRIFT) {
+                printf("<memdupe> Warning: write floor has drifted since calibration, CPU frequency may have dropped\n");
+            }
+        }
+    }
+
+    /* Correct and decode the message if Receiver */
+    if (step > 1 && cfg->role == RECEIVER) {
+        nbits = fec_decode(cfg->fecmode, mask, pages, payload, &ch->fecstats);
+
+        /* Keep the packets that pass their CRC and show the message reassembled so far */
+        bad = ch->rx.bad;
+        count = packet_parse(&ch->rx, payload, nbits);
+        printf("<memdupe> Packets: %ld passed CRC, %ld failed, %ld of %ld received\n",
+               count, ch->rx.bad - bad, ch->rx.nhave, ch->rx.count);
+
+        /* Back off on any loss, otherwise probe for a higher rate */
+        if (cfg->adapt) {
+            outcome = rate_update(&ch->rate, rate_errors(cfg->fecmode, &ch->fecstats), ch->fecstats.codebits,
+                             ch->fecstats.failed + ch->rx.bad - bad, cls.nweak, pages);
+            printf("<memdupe> Rate %s: %ld ppm errors, %ld ppm weak bits, budget %ld pages, lag %ld epochs\n",
+                   rate_name(outcome), ch->rate.ppm, ch->rate.weakppm, ch->rate.pages, ch->rate.lag);
+        }
+        if (ch->rx.count > 0) {
+            msg = decode_message(ch->rx.bits, ch->rx.msglen * BYTEBITS);
+            free(msg);
+        }
+    } else if (step > 1 && cfg->role == SENDER) {
+        /* Apply the ACK read back from the reverse channel */
+        nbits = fec_decode(cfg->fecmode, mask, pages, payload, &ch->fecstats);
+        if (packet_parse(&ch->ackrx, payload, nbits) > 0) {
+            bitvec_unpack(ack, ch->ackrx.bits, ARQ_ACK_BYTES + RATE_ACK_BYTES);
+            count = arq_apply(&ch->arq, ack, ch->ackrx.msglen);
+            printf("<memdupe> ACK: %ld new, %ld of %ld packets acknowledged, %ld retransmitted\n",
+                   count, ch->arq.nacked, ch->arq.count, ch->arq.resent);
+            if (cfg->adapt && ch->ackrx.msglen >= ARQ_ACK_BYTES + RATE_ACK_BYTES) {
+                count = ch->rate.pages;
+                rate_get(&ch->rate, ack + ARQ_ACK_BYTES);
+                if (ch->rate.pages != count) {
+                    printf("<memdupe> Page budget: %ld of %ld pages\n", ch->rate.pages, ch->rate.maxpages);
+                }
+            }
+        } else {
+            printf("<memdupe> ACK: none received\n");
+        }
+    }
+
+    // Free memory...
+    hugepage_free(payload, BITVEC_WORDS(pages) * sizeof(uint64_t));
+    hugepage_free(scratch, CLASS_SCRATCH(pages) * sizeof(uint64_t));
+    hugepage_free(conf, pages * sizeof(uint16_t));
+    hugepage_free(islong, pages);
+    hugepage_free(mask, BITVEC_WORDS(pages) * sizeof(uint64_t));
+
+    return timer_to_ns(ttotal);
+}
+
+/**
+ * encode_message
+ * @brief Encode message before sending through covert channel (bytes => bits)
+ * @param msg The message to be encoded (bytes)
+ * @param nchars Number of bytes in the message
+ * @param nbits Pointer to the number of bits in the encoded message
+ * @return Pointer to the encoded bit vector (packed, MSB of each byte first)
+ */
+uint64_t *encode_message(const char *msg, ulong nchars, ulong *nbits) {
+    uint64_t *bits;
+    ulong i;
+
+    *nbits = nchars * BYTEBITS;
+
+    bits = (uint64_t *) calloc(BITVEC_WORDS(*nbits) + 1, sizeof(uint64_t));
+    bitvec_pack(bits, msg, nchars);
+
+    if (VERBOSE) {
+        printf("<memdupe> Encoded message: '%.*s' => ", (int) nchars, msg);
+        for (i = 0; i < *nbits; i++) {
+            printf("%d", bitvec_get(bits, i));
+            if (i % 8 == 7) {
+                printf(" ");
+            }
+        }
+        printf("\n");
+    } else {
+        printf("<memdupe> Encoded message: %ld bytes => %ld bits\n", nchars, *nbits);
+    }
+
+    return bits;
+}
+
+/**
+ * decode_message
+ * @brief Decode message received through covert channel (bits => bytes)
+ * @param bits Pointer to the packed bit vector from writing pages
+ * @param nbits Number of bits in the message
+ * @return Pointer to the decoded message
+ */
+char *decode_message(uint64_t *bits, ulong nbits) {
+    char *msg = NULL;
+    ulong nchars;
+
+    nchars = nbits / BYTEBITS;
+    msg = (char *) malloc(nchars + 1);
+
+    bitvec_unpack(msg, bits, nchars);
+    msg[nchars] = '\0';
+    printf("<memdupe> Decoded message: '%s'\n", msg);
+
+    return msg;
+}
+
+/**
+ * ksm_wait
+ * @brief Wait until ksmd has completed enough full scans to merge the carrier, falling
+ *        back to a fixed sleep when the KSM counters are unavailable or ksmd is stopped.
+ * @param ch Channel
+ */
+void ksm_wait(struct memdupe_channel *ch) {
+    const struct memdupe_config *cfg = ch->cfg;
+    ulong merged, faults;
+    long waited;
+
+    /* The emulator's scanner stands in for ksmd */
+    if (ch->ksmemu.arena != NULL) {
+        waited = ksmemu_wait(&ch->ksmemu, KSMMON_SCANS);
+        merged = ksmemu_merged(&ch->ksmemu, &faults);
+        printf("<memdupe> Emulated KSM scans done in %ld ms: %ld pages merged, %ld merges broken\n",
+               waited / 1000000, merged, faults);
+        return;
+    }
+
+    if (ksmmon_open(&ch->ksmmon) < 0) {
+        printf("<memdupe> KSM not running, sleep for %d seconds\n", cfg->sleeptime);
+        sleep(cfg->sleeptime);
+        return;
+    }
+
+    printf("<memdupe> Waiting for %d full KSM scans (%ld done, %ld pages every %ld ms)\n",
+           KSMMON_SCANS, ch->ksmmon.stat[KSM_FULL_SCANS], ch->ksmmon.stat[KSM_PAGES_TO_SCAN],
+           ch->ksmmon.stat[KSM_SLEEP_MILLISECS]);
+
+    waited = ksmmon_wait(&ch->ksmmon, KSMMON_SCANS, KSMMON_TIMEOUT);
+    if (waited < 0) {
+        printf("<memdupe> Warning: ksmd did not finish %d scans in %d seconds\n", KSMMON_SCANS, KSMMON_TIMEOUT);
+    } else {
+        printf("<memdupe> KSM scans done in %ld ms: %ld pages shared, %ld pages sharing\n",
+               waited / 1000000, ch->ksmmon.stat[KSM_PAGES_SHARED], ch->ksmmon.stat[KSM_PAGES_SHARING]);
+    }
+
+    ksmmon_close(&ch->ksmmon);
+}
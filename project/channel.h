@@ -0,0 +1,53 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file channel.h
+ * @brief One covert channel instance: carrier loading, the probe round and message coding.
+ * @date 10-17-2026
+ */
+#ifndef _CHANNEL_H_
+#define _CHANNEL_H_
+
+#include <stdint.h>
+
+#include "memdupe.h"
+#include "probe.h"
+#include "worker.h"
+#include "fec.h"
+#include "stream.h"
+#include "ksmmon.h"
+#include "ksmemu.h"
+#include "trace.h"
+#include "packet.h"
+#include "arq.h"
+#include "rate.h"
+#include "noise.h"
+
+/* One channel instance: its configuration plus everything it allocates while running */
+struct memdupe_channel {
+    const struct memdupe_config *cfg;
+    struct probe probe;
+    struct worker_pool pool;
+    struct fec_stats fecstats;
+    struct stream stream;
+    struct ksmmon ksmmon;
+    struct ksmemu ksmemu;
+    struct trace trace;
+    struct packet_rx rx;            /* Receiver's reassembly of the message */
+    struct stream ackstream;        /* Reverse channel: frames the Receiver writes ACKs into */
+    struct packet_rx ackrx;         /* Sender's copy of the latest ACK */
+    struct arq arq;                 /* Sender's selective-repeat state, when ACKs are on */
+    struct rate rate;               /* Probe lag and page budget, when adapting */
+    struct noise noise;             /* Noise floor and disturbance filter, when enabled */
+    uint32_t round;                 /* write_pages calls so far */
+    ulong seq;                      /* Next packet to send */
+    long epoch;                     /* Current epoch when streaming */
+};
+
+char *load_file(const char *path, ulong *fsize);
+ulong write_pages(struct memdupe_channel *ch, char** data, ulong pages, uint step);
+uint64_t *encode_message(const char *msg, ulong nchars, ulong *nbits);
+char *decode_message(uint64_t *bits, ulong nbits);
+void ksm_wait(struct memdupe_channel *ch);
+
+#endif
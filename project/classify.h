@@ -0,0 +1,336 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file classify.h
+ * @brief Robust COW-fault classifier for page write timings.
+ *        Integer-only and header-only so kmemdupe can share it with the user tool.
+ * @date 10-17-2026
+ */
+#ifndef _CLASSIFY_H_
+#define _CLASSIFY_H_
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/types.h>
+#ifndef UINT64_MAX
+#define UINT64_MAX U64_MAX
+#endif
+#else
+#include <stdint.h>
+#endif
+
+/* Classifier methods */
+#define CLASS_MEAN 0    /* Legacy: long if above KSM_THRESHOLD x running mean */
+#define CLASS_MAD  1    /* Long if above baseline median + KSM_THRESHOLD x robust sigma */
+#define CLASS_OTSU 2    /* Two-cluster Otsu split of log2 timings, clusters KSM_THRESHOLD x apart */
+
+#define CLASS_FRAC_BITS 4                       /* Fractional bits of the fixed-point log2 */
+#define CLASS_BINS      (64 << CLASS_FRAC_BITS) /* One histogram bin per fixed-point log2 step */
+#define CLASS_MEAN_BITS 8                       /* Extra precision of cluster means */
+#define CLASS_MAD_SCALE 1483                    /* sigma = 1.4826 x MAD, in per-mille */
+#define CLASS_CONF_MAX  1000                    /* Confidence is reported in per-mille */
+#define CLASS_CONF_WEAK 250                     /* Bits below this confidence are counted as weak */
+
+/* Scratch space (in uint64_t) classify_run needs for n samples */
+#define CLASS_SCRATCH(n) ((n) > CLASS_BINS ? (n) : CLASS_BINS)
+
+struct classify {
+    int method;             /* CLASS_MEAN, CLASS_MAD or CLASS_OTSU */
+    unsigned int k;         /* Threshold factor (ratio for MEAN/OTSU, sigmas for MAD) */
+    int split;              /* True if the timings separated into two clusters */
+    uint64_t median;        /* Baseline (short cluster) median, ticks */
+    uint64_t sigma;         /* Baseline robust sigma, ticks */
+    uint64_t threshold;     /* Long/short boundary, ticks */
+    unsigned long nlong;    /* Samples classified long */
+    unsigned long nweak;    /* Samples below CLASS_CONF_WEAK */
+    unsigned int conf;      /* Mean confidence, per-mille */
+};
+
+/**
+ * class_log2
+ * @brief Fixed-point log2 with CLASS_FRAC_BITS fractional bits (linear mantissa).
+ * @param x Value
+ * @return log2(x) << CLASS_FRAC_BITS, 0 for x <= 1
+ */
+static inline uint64_t class_log2(uint64_t x) {
+    uint64_t msb, frac, mask = (1 << CLASS_FRAC_BITS) - 1;
+
+    if (x <= 1) {
+        return 0;
+    }
+
+    msb = 63 - __builtin_clzll(x);
+    if (msb >= CLASS_FRAC_BITS) {
+        frac = (x >> (msb - CLASS_FRAC_BITS)) & mask;
+    } else {
+        frac = (x << (CLASS_FRAC_BITS - msb)) & mask;
+    }
+
+    return (msb << CLASS_FRAC_BITS) | frac;
+}
+
+/**
+ * class_exp2
+ * @brief Inverse of class_log2.
+ * @param l Fixed-point log2
+ * @return 2^l
+ */
+static inline uint64_t class_exp2(uint64_t l) {
+    uint64_t msb = l >> CLASS_FRAC_BITS;
+    uint64_t mant = (1 << CLASS_FRAC_BITS) | (l & ((1 << CLASS_FRAC_BITS) - 1));
+
+    if (msb >= 63) {
+        return UINT64_MAX;
+    } else if (msb >= CLASS_FRAC_BITS) {
+        return mant << (msb - CLASS_FRAC_BITS);
+    }
+    return mant >> (CLASS_FRAC_BITS - msb);
+}
+
+/**
+ * class_select
+ * @brief Quickselect: partially reorder a so that a[k] is the k-th smallest.
+ * @param a Samples (reordered in place)
+ * @param n Number of samples
+ * @param k Rank to select
+ * @return The k-th smallest sample
+ */
+static inline uint64_t class_select(uint64_t *a, unsigned long n, unsigned long k) {
+    unsigned long lo = 0, hi = n - 1, i, j;
+    uint64_t pivot, tmp;
+
+    while (lo < hi) {
+        pivot = a[lo + (hi - lo) / 2];
+        i = lo;
+        j = hi;
+        while (i <= j) {
+            while (a[i] < pivot) i++;
+            while (a[j] > pivot) j--;
+            if (i <= j) {
+                tmp = a[i]; a[i] = a[j]; a[j] = tmp;
+                i++;
+                if (j == 0) break;
+                j--;
+            }
+        }
+        if (k <= j) {
+            hi = j;
+        } else if (k >= i) {
+            lo = i;
+        } else {
+            break;
+        }
+    }
+
+    return a[k];
+}
+
+/**
+ * class_median_mad
+ * @brief Median and median absolute deviation of the samples at or below a limit.
+ * @param ticks Samples
+ * @param n Number of samples
+ * @param limit Only samples <= limit are used (UINT64_MAX for all)
+ * @param scratch Scratch space of n entries
+ * @param mad Set to the median absolute deviation
+ * @return Median
+ */
+static inline uint64_t class_median_mad(const uint64_t *ticks, unsigned long n, uint64_t limit,
+                                        uint64_t *scratch, uint64_t *mad) {
+    unsigned long i, m = 0;
+    uint64_t median;
+
+    for (i = 0; i < n; i++) {
+        if (ticks[i] <= limit) {
+            scratch[m++] = ticks[i];
+        }
+    }
+
+    if (m == 0) {
+        *mad = 0;
+        return 0;
+    }
+
+    median = class_select(scratch, m, m / 2);
+    for (i = 0; i < m; i++) {
+        scratch[i] = (scratch[i] > median) ? scratch[i] - median : median - scratch[i];
+    }
+    *mad = class_select(scratch, m, m / 2);
+
+    return median;
+}
+
+/**
+ * class_otsu
+ * @brief Otsu's two-cluster split over a histogram of fixed-point log2 timings.
+ *        Working in log2 keeps the spread of the long cluster from swamping the short
+ *        one. A lone outlier can still split off as a cluster of one, so callers that
+ *        act on the split alone should check the cluster size.
+ * @param ticks Samples
+ * @param n Number of samples
+ * @param scratch Scratch space of CLASS_BINS entries (histogram)
+ * @param gap Set to the distance between cluster means, in log2 bins
+ * @return Highest log2 bin of the short cluster, or -1 if there is no split
+ */
+static inline long class_otsu(const uint64_t *ticks, unsigned long n, uint64_t *scratch, uint64_t *gap) {
+    uint64_t *hist = scratch;
+    uint64_t sum = 0, sum0 = 0, w0 = 0, w1, m0, m1, bin;
+    unsigned __int128 score, best = 0;
+    long split = -1, last = -1;
+    unsigned long i;
+
+    *gap = 0;
+    for (i = 0; i < CLASS_BINS; i++) {
+        hist[i] = 0;
+    }
+    for (i = 0; i < n; i++) {
+        bin = class_log2(ticks[i]);
+        if (bin >= CLASS_BINS) {
+            bin = CLASS_BINS - 1;
+        }
+        hist[bin]++;
+        sum += bin;
+    }
+
+    for (i = 0; i < CLASS_BINS; i++) {
+        w0 += hist[i];
+        sum0 += i * hist[i];
+        w1 = n - w0;
+        if (w0 == 0) {
+            continue;
+        } else if (w1 == 0) {
+            break;
+        }
+
+        m0 = (sum0 << CLASS_MEAN_BITS) / w0;
+        m1 = ((sum - sum0) << CLASS_MEAN_BITS) / w1;
+        score = (unsigned __int128) (w0 * w1) * ((m1 - m0) * (m1 - m0));
+        if (score > best) {
+            best = score;
+            split = last = i;
+            *gap = (m1 - m0) >> CLASS_MEAN_BITS;
+        } else if (score == best && last == (long) i - 1) {
+            /* Empty bins between the clusters tie; split in the middle of the run */
+            last = i;
+        }
+    }
+
+    return (split < 0) ? split : (split + last) / 2;
+}
+
+/**
+ * class_confidence
+ * @brief Distance from the threshold relative to a scale, as per-mille.
+ * @param x Sample (in the threshold's units)
+ * @param thr Threshold
+ * @param scale Distance that counts as fully confident
+ * @return Confidence in [0, CLASS_CONF_MAX]
+ */
+static inline unsigned int class_confidence(uint64_t x, uint64_t thr, uint64_t scale) {
+    uint64_t dist = (x > thr) ? x - thr : thr - x;
+
+    if (scale == 0 || dist >= scale) {
+        return CLASS_CONF_MAX;
+    }
+    return (unsigned int) (dist * CLASS_CONF_MAX / scale);
+}
+
+/**
+ * classify_run
+ * @brief Classify every timing as long (COW fault, page was merged) or short. A calibration
+ *        pass over the whole vector runs first, so early pages are judged with full history.
+ * @param c Classifier; method and k must be set, results are filled in (also when n is 0)
+ * @param ticks Per-page write times
+ * @param n Number of pages
+ * @param islong Output: 1 if the page write was long
+ * @param conf Output: per-page confidence in per-mille (may be NULL)
+ * @param scratch Scratch space of CLASS_SCRATCH(n) entries
+ */
+static inline void classify_run(struct classify *c, const uint64_t *ticks, unsigned long n,
+                                uint8_t *islong, uint16_t *conf, uint64_t *scratch) {
+    uint64_t sum = 0, mean, mad, gap = 0, scale = 0, lk, thr;
+    unsigned long confsum = 0, i;
+    unsigned int cf;
+    long split;
+
+    c->nlong = 0;
+    c->nweak = 0;
+    c->conf = 0;
+    c->split = 0;
+    c->median = 0;
+    c->sigma = 0;
+    c->threshold = 0;
+    if (c->method != CLASS_MAD && c->method != CLASS_OTSU) {
+        /* Unknown methods fall back to the legacy running mean */
+        c->method = CLASS_MEAN;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    /* Calibration pass: find the clusters, then the baseline of the short one */
+    lk = class_log2(c->k);
+    split = class_otsu(ticks, n, scratch, &gap);
+    c->split = (split >= 0 && gap >= lk);
+    thr = c->split ? class_exp2(split + 1) - 1 : UINT64_MAX;
+    c->median = class_median_mad(ticks, n, thr, scratch, &mad);
+    c->sigma = mad * CLASS_MAD_SCALE / 1000;
+    if (c->sigma == 0) {
+        c->sigma = 1;
+    }
+
+    if (c->method == CLASS_OTSU && c->split) {
+        c->threshold = thr;
+        scale = (gap + 1) / 2;
+    } else if (c->method == CLASS_OTSU) {
+        /* No second cluster: fall back to a ratio test against the median */
+        c->threshold = c->k * c->median;
+        scale = c->threshold;
+    } else if (c->method == CLASS_MAD) {
+        c->threshold = c->median + c->k * c->sigma;
+        scale = c->k * c->sigma;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (c->method == CLASS_MEAN) {
+            /* Running mean, as the original write_pages did */
+            sum += ticks[i];
+            mean = sum / (i + 1);
+            thr = c->k * mean;
+            islong[i] = (ticks[i] > thr);
+            cf = class_confidence(ticks[i], thr, thr);
+            c->threshold = thr;
+        } else if (c->method == CLASS_OTSU && c->split) {
+            islong[i] = (ticks[i] > c->threshold);
+            cf = class_confidence(2 * class_log2(ticks[i]), 2 * split + 1, 2 * scale);
+        } else {
+            islong[i] = (ticks[i] > c->threshold);
+            cf = class_confidence(ticks[i], c->threshold, scale);
+        }
+
+        c->nlong += islong[i];
+        c->nweak += (cf < CLASS_CONF_WEAK);
+        confsum += cf;
+        if (conf != NULL) {
+            conf[i] = cf;
+        }
+    }
+
+    c->conf = confsum / n;
+}
+
+/**
+ * classify_name
+ * @param method Classifier method
+ * @return Printable method name
+ */
+static inline const char *classify_name(int method) {
+    switch (method) {
+        case CLASS_MEAN: return "mean";
+        case CLASS_MAD:  return "mad";
+        case CLASS_OTSU: return "otsu";
+        default:         return "unknown";
+    }
+}
+
+#endif
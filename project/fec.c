@@ -0,0 +1,426 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file fec.c
+ * @headerfile fec.h
+ * @brief Forward error correction for the KSM covert channel (Hamming(7,4), Reed-Solomon).
+ *        Block layout is derived from the channel size alone, so the receiver can decode
+ *        without knowing how long the sender's message was. Zero padding encodes to zeros.
+ * @date 10-17-2026
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "fec.h"
+#include "bitvec.h"
+
+#define FEC_BYTEBITS 8
+#define HAMMING_N    7
+#define HAMMING_K    4
+
+#define GF_POLY 0x11d   /* x^8 + x^4 + x^3 + x^2 + 1 */
+#define GF_SIZE 255
+
+static uint8_t _gfexp[2 * GF_SIZE];
+static uint8_t _gflog[GF_SIZE + 1];
+static uint8_t _rsgen[FEC_RS_ROOTS + 1];
+static int _gfready = 0;
+
+/**
+ * gf_init
+ * @brief Build the GF(256) log/antilog tables and the Reed-Solomon generator polynomial.
+ */
+static void gf_init(void) {
+    unsigned int x = 1;
+    int i, j;
+
+    for (i = 0; i < GF_SIZE; i++) {
+        _gfexp[i] = _gfexp[i + GF_SIZE] = x;
+        _gflog[x] = i;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= GF_POLY;
+        }
+    }
+
+    /* g(x) = (x - a^0)(x - a^1)...(x - a^(ROOTS-1)), highest degree first */
+    memset(_rsgen, 0, sizeof(_rsgen));
+    _rsgen[0] = 1;
+    for (i = 0; i < FEC_RS_ROOTS; i++) {
+        for (j = i + 1; j > 0; j--) {
+            _rsgen[j] ^= (_rsgen[j - 1] == 0) ? 0 : _gfexp[_gflog[_rsgen[j - 1]] + i];
+        }
+    }
+
+    _gfready = 1;
+}
+
+/**
+ * gf_mul
+ * @return a * b in GF(256)
+ */
+static inline uint8_t gf_mul(uint8_t a, uint8_t b) {
+    return (a == 0 || b == 0) ? 0 : _gfexp[_gflog[a] + _gflog[b]];
+}
+
+/**
+ * gf_div
+ * @return a / b in GF(256), b != 0
+ */
+static inline uint8_t gf_div(uint8_t a, uint8_t b) {
+    return (a == 0) ? 0 : _gfexp[_gflog[a] + GF_SIZE - _gflog[b]];
+}
+
+/**
+ * gf_pow
+ * @return a^e in GF(256) for the primitive element a
+ */
+static inline uint8_t gf_pow(long e) {
+    e %= GF_SIZE;
+    return _gfexp[(e < 0) ? e + GF_SIZE : e];
+}
+
+/**
+ * rs_layout
+ * @brief Split the channel into Reed-Solomon blocks: full 255-byte blocks plus one
+ *        shortened block for the remainder, if it has room for data.
+ * @param chanbits Channel size in bits
+ * @param nfull Set to the number of full blocks
+ * @param rem Set to the length of the shortened block (0 if none)
+ * @return Number of data bytes carried
+ */
+static unsigned long rs_layout(unsigned long chanbits, unsigned long *nfull, unsigned long *rem) {
+    unsigned long nbytes = chanbits / FEC_BYTEBITS;
+
+    *nfull = nbytes / FEC_RS_MAXLEN;
+    *rem = nbytes % FEC_RS_MAXLEN;
+    if (*rem <= FEC_RS_ROOTS) {
+        *rem = 0;
+    }
+
+    return *nfull * (FEC_RS_MAXLEN - FEC_RS_ROOTS) + (*rem ? *rem - FEC_RS_ROOTS : 0);
+}
+
+/**
+ * rs_encode_block
+ * @brief Systematic encode: append the remainder of m(x) x^ROOTS / g(x) to the data bytes.
+ * @param block Block of n bytes; the first n - ROOTS hold data, the rest get parity
+ * @param n Block length
+ */
+static void rs_encode_block(uint8_t *block, unsigned long n) {
+    uint8_t *parity = block + n - FEC_RS_ROOTS;
+    uint8_t fb;
+    unsigned long i;
+    int j;
+
+    memset(parity, 0, FEC_RS_ROOTS);
+    for (i = 0; i < n - FEC_RS_ROOTS; i++) {
+        fb = block[i] ^ parity[0];
+        memmove(parity, parity + 1, FEC_RS_ROOTS - 1);
+        parity[FEC_RS_ROOTS - 1] = 0;
+        if (fb != 0) {
+            for (j = 0; j < FEC_RS_ROOTS; j++) {
+                parity[j] ^= gf_mul(fb, _rsgen[j + 1]);
+            }
+        }
+    }
+}
+
+/**
+ * rs_decode_block
+ * @brief Correct a block in place: syndromes, Berlekamp-Massey, Chien search, Forney.
+ * @param block Block of n bytes
+ * @param n Block length
+ * @return Number of byte errors corrected, or -1 if uncorrectable
+ */
+static int rs_decode_block(uint8_t *block, unsigned long n) {
+    uint8_t synd[FEC_RS_ROOTS];
+    uint8_t lambda[FEC_RS_ROOTS + 1] = {1}, prev[FEC_RS_ROOTS + 1] = {1}, tmp[FEC_RS_ROOTS + 1];
+    uint8_t omega[FEC_RS_ROOTS];
+    uint8_t d, b = 1, s, num, den, xinv;
+    unsigned long i;
+    int j, r, L = 0, m = 1, nerr = 0, bad = 0;
+
+    /* Syndromes S_j = c(a^j), block[0] is the highest-degree coefficient */
+    for (j = 0; j < FEC_RS_ROOTS; j++) {
+        s = 0;
+        for (i = 0; i < n; i++) {
+            s = gf_mul(s, gf_pow(j)) ^ block[i];
+        }
+        synd[j] = s;
+        bad |= (s != 0);
+    }
+    if (!bad) {
+        return 0;
+    }
+
+    /* Berlekamp-Massey: error locator lambda(x), lowest degree first */
+    for (r = 0; r < FEC_RS_ROOTS; r++) {
+        d = synd[r];
+        for (j = 1; j <= L; j++) {
+            d ^= gf_mul(lambda[j], synd[r - j]);
+        }
+
+        if (d == 0) {
+            m++;
+        } else {
+            memcpy(tmp, lambda, sizeof(lambda));
+            for (j = m; j <= FEC_RS_ROOTS; j++) {
+                lambda[j] ^= gf_mul(gf_div(d, b), prev[j - m]);
+            }
+            if (2 * L <= r) {
+                L = r + 1 - L;
+                memcpy(prev, tmp, sizeof(prev));
+                b = d;
+                m = 1;
+            } else {
+                m++;
+            }
+        }
+    }
+    if (L > FEC_RS_ROOTS / 2) {
+        return -1;
+    }
+
+    /* Error evaluator omega(x) = S(x) lambda(x) mod x^ROOTS */
+    for (j = 0; j < FEC_RS_ROOTS; j++) {
+        omega[j] = 0;
+        for (r = 0; r <= j && r <= L; r++) {
+            omega[j] ^= gf_mul(lambda[r], synd[j - r]);
+        }
+    }
+
+    /* Chien search over the (possibly shortened) block, Forney for the magnitudes */
+    for (i = 0; i < n; i++) {
+        xinv = gf_pow(-(long) (n - 1 - i));
+        s = 0;
+        for (j = L; j >= 0; j--) {
+            s = gf_mul(s, xinv) ^ lambda[j];
+        }
+        if (s != 0) {
+            continue;
+        }
+
+        num = 0;
+        for (j = FEC_RS_ROOTS - 1; j >= 0; j--) {
+            num = gf_mul(num, xinv) ^ omega[j];
+        }
+        den = 0;
+        for (j = L - (L % 2 == 0); j >= 1; j -= 2) {
+            den = gf_mul(den, gf_mul(xinv, xinv)) ^ lambda[j];
+        }
+        if (den == 0) {
+            return -1;
+        }
+
+        /* e = X * omega(X^-1) / lambda'(X^-1), X = a^(n-1-i) */
+        block[i] ^= gf_mul(gf_pow(n - 1 - i), gf_div(num, den));
+        nerr++;
+    }
+
+    return (nerr == L) ? nerr : -1;
+}
+
+/**
+ * hamming_encode
+ * @param d Data nibble (d1 is bit 0)
+ * @return 7-bit codeword p1 p2 d1 p3 d2 d3 d4 (position 1 is bit 0)
+ */
+static unsigned int hamming_encode(unsigned int d) {
+    unsigned int d1 = d & 1, d2 = (d >> 1) & 1, d3 = (d >> 2) & 1, d4 = (d >> 3) & 1;
+    unsigned int p1 = d1 ^ d2 ^ d4, p2 = d1 ^ d3 ^ d4, p3 = d2 ^ d3 ^ d4;
+
+    return p1 | (p2 << 1) | (d1 << 2) | (p3 << 3) | (d2 << 4) | (d3 << 5) | (d4 << 6);
+}
+
+/**
+ * hamming_decode
+ * @param c 7-bit codeword
+ * @param fixed Set to 1 if a bit was corrected
+ * @return Data nibble
+ */
+static unsigned int hamming_decode(unsigned int c, int *fixed) {
+    unsigned int s1 = (c ^ (c >> 2) ^ (c >> 4) ^ (c >> 6)) & 1;
+    unsigned int s2 = ((c >> 1) ^ (c >> 2) ^ (c >> 5) ^ (c >> 6)) & 1;
+    unsigned int s3 = ((c >> 3) ^ (c >> 4) ^ (c >> 5) ^ (c >> 6)) & 1;
+    unsigned int syndrome = s1 | (s2 << 1) | (s3 << 2);
+
+    *fixed = (syndrome != 0);
+    if (syndrome) {
+        c ^= 1 << (syndrome - 1);
+    }
+
+    return ((c >> 2) & 1) | (((c >> 4) & 1) << 1) | (((c >> 5) & 1) << 2) | (((c >> 6) & 1) << 3);
+}
+
+/**
+ * fec_capacity
+ * @brief Data bits that fit in a channel of chanbits raw bits.
+ * @param mode FEC mode
+ * @param chanbits Channel size in bits (pages)
+ * @return Data capacity in bits
+ */
+unsigned long fec_capacity(int mode, unsigned long chanbits) {
+    unsigned long nfull, rem;
+
+    if (mode == FEC_HAMMING) {
+        return chanbits / HAMMING_N * HAMMING_K;
+    } else if (mode == FEC_RS) {
+        return rs_layout(chanbits, &nfull, &rem) * FEC_BYTEBITS;
+    }
+    return chanbits;
+}
+
+/**
+ * fec_encode
+ * @brief Encode data bits into channel bits; data is zero-padded (or truncated) to capacity.
+ * @param mode FEC mode
+ * @param data Packed data bits
+ * @param ndata Number of data bits
+ * @param code Output: packed channel bits, BITVEC_WORDS(chanbits) words
+ * @param chanbits Channel size in bits
+ * @return Number of channel bits used
+ */
+unsigned long fec_encode(int mode, const uint64_t *data, unsigned long ndata,
+                         uint64_t *code, unsigned long chanbits) {
+    unsigned long cap = fec_capacity(mode, chanbits);
+    unsigned long i, j, nfull, rem, nblocks, n, k, codebytes;
+    uint8_t *bytes;
+    unsigned int nibble, cw;
+
+    memset(code, 0, BITVEC_WORDS(chanbits) * sizeof(uint64_t));
+    if (ndata > cap) {
+        ndata = cap;
+    }
+
+    if (mode == FEC_HAMMING) {
+        for (i = 0; i < cap / HAMMING_K; i++) {
+            nibble = 0;
+            for (j = 0; j < HAMMING_K; j++) {
+                if (i * HAMMING_K + j < ndata) {
+                    nibble |= bitvec_get(data, i * HAMMING_K + j) << j;
+                }
+            }
+            cw = hamming_encode(nibble);
+            for (j = 0; j < HAMMING_N; j++) {
+                bitvec_assign(code, i * HAMMING_N + j, (cw >> j) & 1);
+            }
+        }
+        return cap / HAMMING_K * HAMMING_N;
+    } else if (mode == FEC_RS) {
+        if (!_gfready) {
+            gf_init();
+        }
+
+        rs_layout(chanbits, &nfull, &rem);
+        nblocks = nfull + (rem != 0);
+        codebytes = nfull * FEC_RS_MAXLEN + rem;
+        bytes = (uint8_t *) calloc(codebytes + BITVEC_WORD_BYTES, 1);
+
+        /* Scatter data bits into the data part of each block */
+        for (i = 0; i < ndata; i++) {
+            k = i / FEC_BYTEBITS;
+            j = k / (FEC_RS_MAXLEN - FEC_RS_ROOTS) * FEC_RS_MAXLEN + k % (FEC_RS_MAXLEN - FEC_RS_ROOTS);
+            bytes[j] |= bitvec_get(data, i) << (FEC_BYTEBITS - 1 - i % FEC_BYTEBITS);
+        }
+
+        for (i = 0; i < nblocks; i++) {
+            n = (i < nfull) ? FEC_RS_MAXLEN : rem;
+            rs_encode_block(bytes + i * FEC_RS_MAXLEN, n);
+        }
+
+        bitvec_pack(code, (char *) bytes, codebytes);
+        free(bytes);
+        return codebytes * FEC_BYTEBITS;
+    }
+
+    for (i = 0; i < ndata; i++) {
+        bitvec_assign(code, i, bitvec_get(data, i));
+    }
+    return ndata;
+}
+
+/**
+ * fec_decode
+ * @brief Decode every codeword in the channel, correcting what the code allows.
+ * @param mode FEC mode
+ * @param code Packed channel bits
+ * @param chanbits Channel size in bits
+ * @param data Output: packed data bits, BITVEC_WORDS(chanbits) words
+ * @param stats Output: decode statistics
+ * @return Number of data bits decoded
+ */
+unsigned long fec_decode(int mode, const uint64_t *code, unsigned long chanbits,
+                         uint64_t *data, struct fec_stats *stats) {
+    unsigned long cap = fec_capacity(mode, chanbits);
+    unsigned long i, j, nfull, rem, nblocks, n, codebytes, datalen;
+    uint8_t *bytes;
+    unsigned int cw, nibble;
+    int fixed;
+
+    memset(data, 0, BITVEC_WORDS(chanbits) * sizeof(uint64_t));
+    memset(stats, 0, sizeof(*stats));
+    stats->databits = cap;
+
+    if (mode == FEC_HAMMING) {
+        for (i = 0; i < cap / HAMMING_K; i++) {
+            cw = 0;
+            for (j = 0; j < HAMMING_N; j++) {
+                cw |= bitvec_get(code, i * HAMMING_N + j) << j;
+            }
+            nibble = hamming_decode(cw, &fixed);
+            stats->corrected += fixed;
+            for (j = 0; j < HAMMING_K; j++) {
+                bitvec_assign(data, i * HAMMING_K + j, (nibble >> j) & 1);
+            }
+        }
+        stats->codebits = cap / HAMMING_K * HAMMING_N;
+    } else if (mode == FEC_RS) {
+        if (!_gfready) {
+            gf_init();
+        }
+
+        rs_layout(chanbits, &nfull, &rem);
+        nblocks = nfull + (rem != 0);
+        codebytes = nfull * FEC_RS_MAXLEN + rem;
+        bytes = (uint8_t *) calloc(codebytes + BITVEC_WORD_BYTES, 1);
+        bitvec_unpack((char *) bytes, code, codebytes);
+
+        for (i = 0; i < nblocks; i++) {
+            n = (i < nfull) ? FEC_RS_MAXLEN : rem;
+            fixed = rs_decode_block(bytes + i * FEC_RS_MAXLEN, n);
+            if (fixed < 0) {
+                stats->failed++;
+            } else {
+                stats->corrected += fixed;
+            }
+        }
+
+        /* Gather the data part of each block back into one contiguous stream */
+        for (i = 0; i < nblocks; i++) {
+            datalen = ((i < nfull) ? FEC_RS_MAXLEN : rem) - FEC_RS_ROOTS;
+            memmove(bytes + i * (FEC_RS_MAXLEN - FEC_RS_ROOTS), bytes + i * FEC_RS_MAXLEN, datalen);
+        }
+        bitvec_pack(data, (char *) bytes, cap / FEC_BYTEBITS);
+        free(bytes);
+        stats->codebits = codebytes * FEC_BYTEBITS;
+    } else {
+        memcpy(data, code, BITVEC_WORDS(chanbits) * sizeof(uint64_t));
+        stats->codebits = chanbits;
+    }
+
+    return cap;
+}
+
+/**
+ * fec_name
+ * @param mode FEC mode
+ * @return Printable mode name
+ */
+const char *fec_name(int mode) {
+    switch (mode) {
+        case FEC_HAMMING: return "hamming";
+        case FEC_RS:      return "rs";
+        default:          return "none";
+    }
+}
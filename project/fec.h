@@ -0,0 +1,35 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file fec.h
+ * @brief Forward error correction for the KSM covert channel (Hamming(7,4), Reed-Solomon).
+ * @date 10-17-2026
+ */
+#ifndef _FEC_H_
+#define _FEC_H_
+
+#include <stdint.h>
+
+/* FEC modes */
+#define FEC_NONE    0
+#define FEC_HAMMING 1   /* Hamming(7,4): corrects one bit error per 7-bit codeword */
+#define FEC_RS      2   /* Reed-Solomon over GF(256): corrects FEC_RS_ROOTS/2 byte errors per block */
+
+#define FEC_RS_ROOTS   16   /* Parity bytes per Reed-Solomon block */
+#define FEC_RS_MAXLEN  255  /* Longest Reed-Solomon block (bytes) */
+
+struct fec_stats {
+    unsigned long databits;   /* Data bits carried */
+    unsigned long codebits;   /* Channel bits used to carry them */
+    unsigned long corrected;  /* Bit (Hamming) or byte (Reed-Solomon) errors corrected */
+    unsigned long failed;     /* Codewords with uncorrectable errors */
+};
+
+unsigned long fec_capacity(int mode, unsigned long chanbits);
+unsigned long fec_encode(int mode, const uint64_t *data, unsigned long ndata,
+                         uint64_t *code, unsigned long chanbits);
+unsigned long fec_decode(int mode, const uint64_t *code, unsigned long chanbits,
+                         uint64_t *data, struct fec_stats *stats);
+const char *fec_name(int mode);
+
+#endif
@@ -0,0 +1,168 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file hugepage.c
+ * @headerfile hugepage.h
+ * @brief Huge page policy: keep THP off the channel pages, back bookkeeping with huge pages.
+ *        Whether khugepaged collapses the carrier changes timings from run to run, and the
+ *        probe loop's timing array takes TLB misses of its own on large carriers.
+ * @date 10-17-2026
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "hugepage.h"
+
+#define SMAPS_LINE 256
+
+static int _policy = HUGE_OFF;
+
+/**
+ * hugepage_init
+ * @brief Set the allocation policy.
+ * @param policy HUGE_* flags
+ */
+void hugepage_init(int policy) {
+    _policy = policy;
+}
+
+/**
+ * hugepage_channel
+ * @brief Apply the channel policy to a carrier region. Call before the pages are first
+ *        touched for anonymous memory; file-backed COW pages are never THP at fault
+ *        time, so there it only stops khugepaged from collapsing them later.
+ * @param addr Start of the region
+ * @param len Length of the region
+ */
+void hugepage_channel(void *addr, size_t len) {
+    if ((_policy & HUGE_NOTHP) && madvise(addr, len, MADV_NOHUGEPAGE) < 0) {
+        printf("<memdupe> Warning: madvise(MADV_NOHUGEPAGE) failed on carrier\n");
+    }
+}
+
+/**
+ * huge_length
+ * @param size Requested size
+ * @return Size rounded up to a whole huge page
+ */
+static size_t huge_length(size_t size) {
+    return (size + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1);
+}
+
+/**
+ * hugepage_alloc
+ * @brief Allocate a zeroed bookkeeping buffer. With HUGE_BUFFERS, large buffers come from
+ *        hugetlb if pages are reserved, else from a 2 MiB-aligned THP (MADV_HUGEPAGE) region.
+ * @param size Size in bytes
+ * @return Pointer to the buffer, NULL on error
+ */
+void *hugepage_alloc(size_t size) {
+    size_t len = huge_length(size);
+    uintptr_t base, aligned;
+    char *raw;
+
+    if (!(_policy & HUGE_BUFFERS) || size < HUGE_MIN) {
+        return calloc(size, 1);
+    }
+
+    raw = (char *) mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    if (raw != MAP_FAILED) {
+        return raw;
+    }
+
+    /* No reserved hugetlb pages: over-allocate, trim to a 2 MiB boundary, ask for THP */
+    raw = (char *) mmap(NULL, len + HUGE_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+
+    base = (uintptr_t) raw;
+    aligned = (base + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1);
+    if (aligned > base) {
+        munmap(raw, aligned - base);
+    }
+    munmap((char *) aligned + len, base + HUGE_SIZE - aligned);
+    madvise((char *) aligned, len, MADV_HUGEPAGE);
+
+    return (void *) aligned;
+}
+
+/**
+ * hugepage_free
+ * @brief Free a buffer from hugepage_alloc.
+ * @param addr Buffer
+ * @param size Size passed to hugepage_alloc
+ */
+void hugepage_free(void *addr, size_t size) {
+    if (addr == NULL) {
+        return;
+    } else if (!(_policy & HUGE_BUFFERS) || size < HUGE_MIN) {
+        free(addr);
+    } else {
+        munmap(addr, huge_length(size));
+    }
+}
+
+/**
+ * hugepage_report
+ * @brief Print the THP state actually obtained for the mapping holding addr, read from
+ *        /proc/self/smaps, along with the system THP mode.
+ * @param name Label for the region
+ * @param addr Any address inside the region
+ */
+void hugepage_report(const char *name, const void *addr) {
+    char line[SMAPS_LINE];
+    char mode[SMAPS_LINE] = "unknown";
+    unsigned long start, end, value;
+    unsigned long size = 0, pagesize = 0, anonhuge = 0, hugetlb = 0, eligible = 0;
+    int found = 0;
+    FILE *fp;
+
+    fp = fopen(THP_ENABLED, "r");
+    if (fp != NULL) {
+        if (fgets(mode, sizeof(mode), fp) != NULL) {
+            mode[strcspn(mode, "\n")] = '\0';
+        }
+        fclose(fp);
+    }
+
+    fp = fopen("/proc/self/smaps", "r");
+    if (fp == NULL) {
+        printf("<memdupe> Error: Could not open file '/proc/self/smaps'\n");
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            if (found) {
+                break;
+            }
+            found = ((uintptr_t) addr >= start && (uintptr_t) addr < end);
+        } else if (!found) {
+            continue;
+        } else if (sscanf(line, "Size: %lu kB", &value) == 1) {
+            size = value;
+        } else if (sscanf(line, "KernelPageSize: %lu kB", &value) == 1) {
+            pagesize = value;
+        } else if (sscanf(line, "AnonHugePages: %lu kB", &value) == 1) {
+            anonhuge = value;
+        } else if (sscanf(line, "Private_Hugetlb: %lu kB", &value) == 1) {
+            hugetlb = value;
+        } else if (sscanf(line, "THPeligible: %lu", &value) == 1) {
+            eligible = value;
+        }
+    }
+    fclose(fp);
+
+    if (!found) {
+        printf("<memdupe> THP %s: not a separate mapping (heap), system mode %s\n", name, mode);
+        return;
+    }
+
+    printf("<memdupe> THP %s: %lu kB mapped, %lu kB page size, %lu kB THP, %lu kB hugetlb, "
+           "THP eligible %lu, system mode %s\n",
+           name, size, pagesize, anonhuge, hugetlb, eligible, mode);
+}
@@ -0,0 +1,30 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file hugepage.h
+ * @brief Huge page policy: keep THP off the channel pages, back bookkeeping with huge pages.
+ * @date 10-17-2026
+ */
+#ifndef _HUGEPAGE_H_
+#define _HUGEPAGE_H_
+
+#include <stddef.h>
+
+/* Allocation policy flags */
+#define HUGE_OFF     0
+#define HUGE_NOTHP   1   /* MADV_NOHUGEPAGE on channel pages: KSM only merges 4 KiB pages */
+#define HUGE_BUFFERS 2   /* Timing and bookkeeping buffers from hugetlb or THP */
+#define HUGE_DEFAULT (HUGE_NOTHP | HUGE_BUFFERS)
+
+#define HUGE_SIZE    (2UL << 20)     /* x86-64 PMD huge page */
+#define HUGE_MIN     (HUGE_SIZE / 8) /* Smaller buffers stay on the heap */
+
+#define THP_ENABLED  "/sys/kernel/mm/transparent_hugepage/enabled"
+
+void hugepage_init(int policy);
+void hugepage_channel(void *addr, size_t len);
+void *hugepage_alloc(size_t size);
+void hugepage_free(void *addr, size_t size);
+void hugepage_report(const char *name, const void *addr);
+
+#endif
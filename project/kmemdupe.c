@@ -1,12 +1,126 @@
 #include <linux/module.h>/* Needed by all modules */
 #include <linux/kernel.h>/* Needed for KERN_INFO */
+#include <linux/ksm.h>      /* PageKsm */
+#include <linux/mm.h>       /* Page table walk */
+#include <linux/sched/mm.h> /* get_task_mm */
+#include <linux/string.h>   /* memdup_user_nul */
+#include <linux/completion.h> /* Round done */
+#include <linux/debugfs.h>  /* Control surface */
 #include <linux/delay.h>    /* Sleep function */
+#include <linux/err.h>      /* IS_ERR */
 #include <linux/fs.h>       /* File functions */
+#include <linux/math64.h>   /* 64-bit division */
+#include <linux/moduleparam.h> /* Module parameters */
+#include <linux/mutex.h>    /* Run and result locks */
+#include <linux/seq_file.h> /* debugfs text files */
 #include <linux/slab.h>     /* Mem functions */
-#include <linux/time.h>     /* Timer functions */
-#include <linux/uaccess.h>  /* Needed by segment descriptors */
+#include <linux/vmalloc.h>  /* vmalloc */
+#include <linux/wait.h>     /* Interruptible sleep */
+#include <linux/workqueue.h> /* Measurement rounds */
+#include <linux/timekeeping.h> /* ktime_get_ns */
+#ifdef CONFIG_X86
+#include <asm/msr.h>        /* rdtsc_ordered */
+#include <asm/tsc.h>        /* tsc_khz */
+#endif
 
 #include "memdupe.h"
+#include "bitvec.h"
+#include "classify.h"
+
+#define RATIO_SCALE 1000    /* Write time ratios are fixed-point, in thousandths */
+#define CLUSTER_DIV 4       /* A long cluster counts once it holds pages / (CLUSTER_DIV x threshold) */
+
+#define KMEMDUPE_IDLE    0
+#define KMEMDUPE_RUNNING 1
+#define KMEMDUPE_MAX_SECONDS 86400   /* Longest sleeptime or period accepted */
+
+#define KSMWALK_MAX     (1UL << 20)  /* Pages one walk may cover (4 GB) */
+#define KSMWALK_PRESENT 1
+#define KSMWALK_KSM     2            /* PageKsm: a stable KSM page */
+#define KSMWALK_ZERO    4            /* Merged into the zero page (use_zero_pages) */
+#define KSMWALK_HUGE    8            /* Mapped by a huge PMD, never KSM */
+
+static char _filepath[1024] = FILEPATH;
+static char _message[1024] = MESSAGE;
+
+static int _vmrole = SENDER;
+static int _sleeptime = NUM_SECONDS;
+static int _ksmthresh = KSM_THRESHOLD;
+static int _readtwice = TRUE;
+static int _classifier = CLASS_OTSU;
+static int _autorun = TRUE;
+static int _period;
+
+module_param_string(filepath, _filepath, sizeof(_filepath), 0644);
+MODULE_PARM_DESC(filepath, "Carrier file");
+module_param_string(message, _message, sizeof(_message), 0644);
+MODULE_PARM_DESC(message, "Message written over the pages");
+module_param_named(role, _vmrole, int, 0644);
+MODULE_PARM_DESC(role, "tester|sender|receiver (0|1|2): write both sides of the wait, before it, or after it");
+module_param_named(sleeptime, _sleeptime, int, 0644);
+MODULE_PARM_DESC(sleeptime, "Seconds to wait for KSM between the writes");
+module_param_named(threshold, _ksmthresh, int, 0644);
+MODULE_PARM_DESC(threshold, "Slow-down ratio and classifier gap");
+module_param_named(readtwice, _readtwice, int, 0644);
+MODULE_PARM_DESC(readtwice, "Ignored, kept for compatibility: KSM only merges anonymous pages");
+module_param_named(classifier, _classifier, int, 0644);
+MODULE_PARM_DESC(classifier, "mean|mad|otsu (0|1|2)");
+module_param_named(autorun, _autorun, int, 0444);
+MODULE_PARM_DESC(autorun, "Start measuring at load");
+module_param_named(period, _period, int, 0644);
+MODULE_PARM_DESC(period, "Seconds between rounds, 0 for a single round");
+
+/* Parameters of one run, copied while the parameters cannot change */
+struct kmemdupe_config {
+    char filepath[sizeof(_filepath)];
+    char message[sizeof(_message)];
+    int role;
+    int sleeptime;
+    int ksmthresh;
+    int classifier;
+};
+
+/* Outcome of the last completed run, read through debugfs */
+struct kmemdupe_result {
+    ulong runs;                 /* Runs completed */
+    ulong stopped;              /* Runs cut short by stop */
+    int role;
+    ulong pages;
+    ulong wtime;                /* First write, ns */
+    ulong w2time;               /* Second write, ns */
+    ulong ratio;                /* w2time / wtime, in RATIO_SCALE */
+    uint vm_stat;
+    struct classify cls;
+    uint64_t *timings;          /* Second write of each page, ns */
+};
+
+/* One page of the last page-table walk */
+struct ksmwalk_entry {
+    ulong pfn;
+    uint flags;
+    int mapcount;               /* Mappings of the page: its sharing count when KSM */
+};
+
+/* Last page-table walk, read through debugfs */
+struct ksmwalk {
+    pid_t pid;
+    ulong start;
+    ulong pages;
+    ulong present, ksm, zero, shared;
+    struct ksmwalk_entry *entries;
+};
+
+static struct kmemdupe_result _result;
+static struct ksmwalk _walk;
+static DEFINE_MUTEX(_walklock);     /* Guards _walk */
+static struct dentry *_debugfs;
+static struct workqueue_struct *_wq;
+static DECLARE_DELAYED_WORK(_round, round_work);
+static DECLARE_COMPLETION(_done);   /* Completed at the end of every round */
+static DEFINE_MUTEX(_resultlock);   /* Guards _result */
+static DECLARE_WAIT_QUEUE_HEAD(_stopq);
+static int _state = KMEMDUPE_IDLE;
+static int _stop;
 
 static int cpl_check(void) {
     uint csr, mask, cpl;
@@ -61,167 +175,258 @@ static int virt_test(void) {
     return vmx_on;
 }
 
-static ulong get_clock_time(void) {
-    struct timespec ts;
-    ulong now;
-
-    getnstimeofday(&ts);
-    now = timespec_to_ns(&ts);
+/**
+ * get_ticks
+ * @brief Read the finest clock available for timing one page write: the serialized TSC on
+ *        x86, the monotonic clock elsewhere.
+ * @return Ticks
+ */
+static inline uint64_t get_ticks(void) {
+#ifdef CONFIG_X86
+    if (tsc_khz > 0) {
+        return rdtsc_ordered();
+    }
+#endif
+    return ktime_get_ns();
+}
 
-    return now;
+/**
+ * ticks_to_ns
+ * @param ticks Ticks from get_ticks
+ * @return Nanoseconds
+ */
+static inline uint64_t ticks_to_ns(uint64_t ticks) {
+#ifdef CONFIG_X86
+    if (tsc_khz > 0) {
+        return div64_u64(ticks * 1000000ULL, tsc_khz);
+    }
+#endif
+    return ticks;
 }
 
+/**
+ * load_file
+ * @brief Read a file into a private, writable copy. The buffer is vmalloc'd, so a
+ *        multi-megabyte carrier needs no contiguous allocation.
+ * @param path File path
+ * @param fsize Output, file size, 0 on failure
+ * @return Terminated file contents, free with vfree, NULL on failure
+ */
 static char *load_file(const char *path, ulong *fsize) {
     char *data = NULL;
     struct file *fp;
-    struct inode *inode;
-    mm_segment_t fs;
+    loff_t pos = 0;
+    ssize_t nread;
+
+    *fsize = 0;
 
     // Open file
     fp = filp_open(path, O_RDONLY, 0);
+    if (IS_ERR(fp)) {
+        printk("<memdupe> Error opening file: '%s'\n", path);
+        return NULL;
+    }
 
-    if (fp != NULL) {
-        /* Get file size */
-        inode = fp->f_path.dentry->d_inode;
-        *fsize = inode->i_size;
-
-        // Allocate buffer...
-        data = (char *) kmalloc(*fsize + 1, GFP_ATOMIC);
-
-        if (data != NULL) {
-            printk("<memdupe> Reading file: '%s'\n", path);
+    /* Get file size */
+    *fsize = i_size_read(file_inode(fp));
 
-            fs = get_fs();
-            set_fs(KERNEL_DS);
+    // Allocate buffer...
+    data = (char *) vmalloc(*fsize + 1);
 
-            fp->f_op->read(fp, data, *fsize, &(fp->f_pos));
-            data[*fsize] = '\0';  // Terminate string
+    if (data != NULL) {
+        printk("<memdupe> Reading file: '%s'\n", path);
 
-            // Restore segment descriptor
-            set_fs(fs);
-        } else {
-            printk("<memdupe> Error allocating data: %ld bytes\n", *fsize);
-            *fsize = 0;
+        /* kernel_read may return short counts, so read until EOF */
+        while (pos < *fsize) {
+            nread = kernel_read(fp, data + pos, *fsize - pos, &pos);
+            if (nread <= 0) {
+                break;
+            }
         }
-
-        // Close file
-        filp_close(fp, NULL);
+        *fsize = pos;
+        data[*fsize] = '\0';  // Terminate string
     } else {
-        printk("<memdupe> Error opening file: '%s'\n", path);
+        printk("<memdupe> Error allocating data: %ld bytes\n", *fsize);
         *fsize = 0;
     }
 
+    // Close file
+    filp_close(fp, NULL);
+
     return data;
 }
 
-static ulong write_pages(char** data, ulong pages, uint step) {
+/**
+ * write_pages
+ * @brief Write the message over the pages, one character per page from the last page down,
+ *        and time every write on its own. On the second pass, the timings go through the
+ *        same classifier as the user tool.
+ * @param cfg Parameters of the run
+ * @param data Pages to write
+ * @param pages Number of pages
+ * @param step 1 for the first pass, 2 to classify
+ * @param cls Classifier results, filled in when step > 1
+ * @param timings Output, per-page write times in ns (may be NULL)
+ * @return Total write time, ns
+ */
+static ulong write_pages(const struct kmemdupe_config *cfg, char** data, ulong pages, uint step,
+                         struct classify *cls, uint64_t *timings) {
     char *buffer;
+    uint64_t *ticks;
+    uint64_t *scratch = NULL;
+    uint8_t *islong = NULL;
+    uint64_t t0;
 
     ulong index = 0;
-    ulong time1 = 0;
-    ulong time2 = 0;
-
-    buffer = (char *) kmalloc(sizeof(char) * pages, GFP_ATOMIC);
+    ulong total = 0;
+
+    buffer = (char *) vmalloc(sizeof(char) * pages + 1);
+    ticks = (uint64_t *) vmalloc(sizeof(uint64_t) * pages);
+    if (buffer == NULL || ticks == NULL) {
+        printk("<memdupe> Error allocating timing data for %ld pages\n", pages);
+        vfree(buffer);
+        vfree(ticks);
+        return 0;
+    }
     memset(buffer, '.', sizeof(char) * pages);
-    strcpy(buffer, _message);
+    memcpy(buffer, cfg->message, min(strlen(cfg->message), (size_t) pages));
+
+    /* Time each write on its own, so one slow page cannot hide in the total */
+    for (index = 0; index < pages; index++) {
+        t0 = get_ticks();
+        (*data)[(pages - index) * MY_PAGE_SIZE - 1] = buffer[index];
+        ticks[index] = get_ticks() - t0;
+        total += ticks[index];
+    }
 
-    /* Start timer for writing pages... */
-    time1 = get_clock_time();
+    if (step > 1) {
+        islong = (uint8_t *) vmalloc(pages);
+        scratch = (uint64_t *) vmalloc(CLASS_SCRATCH(pages) * sizeof(uint64_t));
+    }
 
-    do {
-        (*data)[pages * MY_PAGE_SIZE - 1] = buffer[index];
-        index++;
-        pages--;
-    } while (pages > 0);
+    if (islong != NULL && scratch != NULL) {
+        cls->method = cfg->classifier;
+        cls->k = cfg->ksmthresh;
+        classify_run(cls, ticks, pages, islong, NULL, scratch);
 
-    /* Stop timer */
-    time2 = get_clock_time();
+        printk("<memdupe> Classifier %s: threshold %llu ns, median %llu ns, %ld of %ld pages long, "
+               "confidence %u.%u%%, %ld weak bits\n",
+               classify_name(cls->method), ticks_to_ns(cls->threshold), ticks_to_ns(cls->median),
+               cls->nlong, pages, cls->conf / 10, cls->conf % 10, cls->nweak);
+    }
 
-    kfree(buffer);
+    for (index = 0; timings != NULL && index < pages; index++) {
+        timings[index] = ticks_to_ns(ticks[index]);
+    }
+
+    vfree(scratch);
+    vfree(islong);
+    vfree(ticks);
+    vfree(buffer);
 
-    return (time2 - time1);
+    return ticks_to_ns(total);
 }
 
-static void free_data(ulong fsize, char** data0, char **data1, char **data2) {
-    kfree(*data0);
-    if (data1 != NULL) {
-        kfree(*data1);
-    }
-    if (data2 != NULL) {
-        kfree(*data2);
-    }
+static void free_data(ulong fsize, char** data0) {
+    vfree(*data0);
 }
 
-static char *encode_message(char *msg, ulong *nbits) {
-    char buff[BYTEBITS];
-    char *bits;
-    int i, j;
-    uint index;
-    uint nchars;
+static uint64_t *encode_message(char *msg, ulong *nbits) {
+    uint64_t *bits;
+    ulong i;
+    ulong nchars;
 
     nchars = strlen(msg);
     *nbits = nchars * BYTEBITS;
 
-    bits = (char*) kmalloc(*nbits, GFP_ATOMIC);
-
-    index = 0;
-    for (i = 0; i < nchars; i++) {
-        for (j = 0; j < BYTEBITS; j++) {
-            buff[j] = (msg[i] & (BITMASK << j)) != 0;
-        }
+    bits = (uint64_t *) kzalloc((BITVEC_WORDS(*nbits) + 1) * sizeof(uint64_t), GFP_ATOMIC);
+    bitvec_pack(bits, msg, nchars);
 
-        for (j = BYTEBITS - 1; j >= 0; j--) {
-            bits[index++] = buff[j];
-        }
-    }
-
-    printk("encode_message: '%s' => ", msg);
-    for (i = 0; i < *nbits; i++) {
-        printk("%d", bits[i]);
-        if (i % 8 == 7) {
-            printk(" ");
+    if (VERBOSE) {
+        printk("encode_message: '%s' => ", msg);
+        for (i = 0; i < *nbits; i++) {
+            printk(KERN_CONT "%d", bitvec_get(bits, i));
+            if (i % 8 == 7) {
+                printk(KERN_CONT " ");
+            }
         }
+        printk(KERN_CONT "\n");
+    } else {
+        printk("encode_message: %ld bytes => %ld bits\n", nchars, *nbits);
     }
-    printk("\n");
 
     return bits;
 }
 
-static char *decode_message(char *bits, ulong nbits) {
-    char bit;
-    char val = '\0';
+static char *decode_message(uint64_t *bits, ulong nbits) {
     char *msg = NULL;
-    int i, j;
-    uint index;
-    uint nchars;
+    ulong nchars;
 
     nchars = nbits / BYTEBITS;
     msg = (char *) kmalloc(nchars + 1, GFP_ATOMIC);
 
-    index = 0;
-    for (i = 0; i < nbits; i += BYTEBITS) {
-        val = 0;
-        for (j = 0; j < BYTEBITS; j++) {
-            bit = bits[i + j];
-            val *= 2;
-            val += bit;
-        }
-        msg[index] = val;
-        index += 1;
-    }
-
-    msg[index] = '\0';
+    bitvec_unpack(msg, bits, nchars);
+    msg[nchars] = '\0';
 
     printk("decode_message: %s\n", msg);
 
     return msg;
 }
 
-static int __init memdupe_init(void) {
-    char *data0, *data1 = NULL, *data2 = NULL;
+/**
+ * get_config
+ * @brief Copy the parameters for one run under the parameter lock, so a write through
+ *        /sys/module/kmemdupe/parameters cannot be seen half done, and check them.
+ * @param cfg Output
+ * @return 0, or -EINVAL if a parameter is out of range
+ */
+static int get_config(struct kmemdupe_config *cfg) {
+    kernel_param_lock(THIS_MODULE);
+    strscpy(cfg->filepath, _filepath, sizeof(cfg->filepath));
+    strscpy(cfg->message, _message, sizeof(cfg->message));
+    cfg->role = _vmrole;
+    cfg->sleeptime = _sleeptime;
+    cfg->ksmthresh = _ksmthresh;
+    cfg->classifier = _classifier;
+    kernel_param_unlock(THIS_MODULE);
+
+    if (cfg->role < TESTER || cfg->role > RECEIVER) {
+        printk("<memdupe> Error: role %d is not tester, sender or receiver (0|1|2)\n", cfg->role);
+        return -EINVAL;
+    }
+    if (cfg->sleeptime < 0 || cfg->sleeptime > KMEMDUPE_MAX_SECONDS) {
+        printk("<memdupe> Error: sleeptime %d is outside 0-%d seconds\n", cfg->sleeptime, KMEMDUPE_MAX_SECONDS);
+        return -EINVAL;
+    }
+    if (cfg->ksmthresh < 1) {
+        printk("<memdupe> Error: threshold %d is below 1\n", cfg->ksmthresh);
+        return -EINVAL;
+    }
+    if (cfg->classifier < CLASS_MEAN || cfg->classifier > CLASS_OTSU) {
+        printk("<memdupe> Error: classifier %d is not mean, mad or otsu (0|1|2)\n", cfg->classifier);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * memdupe_run
+ * @brief One measurement: write the carrier's pages, wait for KSM, write them again and
+ *        compare. The Sender only writes its message before the wait, and the Receiver only
+ *        probes after it; the Tester does both. The wait ends early on stop. Results
+ *        replace the previous run's.
+ * @return vm_stat, -EINTR if stopped, or a negative error
+ */
+static int memdupe_run(void) {
+    struct kmemdupe_config *cfg;
+    char *data0;
+    uint64_t *timings = NULL;
 
     uint vm_stat = 0;
-    uint cpl_flag = 0;
+    int stopped = FALSE;
+
+    struct classify cls = {0};
 
     ulong fsize;
     ulong pages;
@@ -229,67 +434,535 @@ static int __init memdupe_init(void) {
     ulong w2time = 0;
     ulong ratio = 0;
 
-    _sleeptime = NUM_SECONDS;
-    _vmrole = SENDER;
-    strcpy(_filepath, FILEPATH);
-    strcpy(_message, MESSAGE);
-    _ksmthresh = KSM_THRESHOLD;
-    _readtwice = TRUE;
-
-    /* Check CPL flag */
-    cpl_flag = cpl_check();
-
-    if (cpl_flag == CPL_KERN) {
-        printk("<memdupe> Running memdupe_init in kernel mode\n");
+    /* Too large for the kernel stack */
+    cfg = (struct kmemdupe_config *) kmalloc(sizeof(*cfg), GFP_KERNEL);
+    if (cfg == NULL) {
+        return -ENOMEM;
+    }
+    if (get_config(cfg) < 0) {
+        kfree(cfg);
+        return -EINVAL;
+    }
 
-        /* Load a file */
-        data0 = load_file(_filepath, &fsize);
+    /* Load a private copy of the file: its pages are written */
+    data0 = load_file(cfg->filepath, &fsize);
 
-        if (fsize > 0 && data0 != NULL) {
-            pages = fsize / MY_PAGE_SIZE;
-            printk("<memdupe> Read file of size %ld B, %ld pages\n", fsize, pages);
+    if (fsize > 0 && data0 != NULL) {
+        pages = fsize / MY_PAGE_SIZE;
+        printk("<memdupe> Read file of size %ld B, %ld pages\n", fsize, pages);
 
-            /* Write pages once... */
-            wtime = write_pages(&data0, pages, 1);
+        /* Write pages once... -- Sender encodes message */
+        if (cfg->role != RECEIVER) {
+            wtime = write_pages(cfg, &data0, pages, 1, &cls, NULL);
             printk("<memdupe> Wrote '.' to %ld pages once in %ld ns\n", pages, wtime);
+        }
 
-            /* Load file 2 more times */
-            if (_readtwice) {
-                data1 = load_file(_filepath, &fsize);
-                data2 = load_file(_filepath, &fsize);
-                printk("<memdupe> Read file '%s' 2 more times\n", _filepath);
-            }
-
-            /* Sleep... */
-            printk("<memdupe> Sleep for %d seconds\n", _sleeptime);
-            msleep(_sleeptime * 1000);
-
-            /* Write pages again... */
-            w2time = write_pages(&data0, pages, 2);
+        /* Sleep, unless told to stop... */
+        printk("<memdupe> Sleep for %d seconds\n", cfg->sleeptime);
+        stopped = wait_event_interruptible_timeout(_stopq, READ_ONCE(_stop),
+                                                   msecs_to_jiffies(cfg->sleeptime * 1000)) != 0;
+
+        if (stopped) {
+            printk("<memdupe> Stopped before the second write\n");
+        } else if (cfg->role != SENDER) {
+            /* Write pages again... -- Receiver detects the long writes */
+            timings = (uint64_t *) vmalloc(sizeof(uint64_t) * pages);
+            w2time = write_pages(cfg, &data0, pages, 2, &cls, timings);
             printk("<memdupe> Wrote '.' to %ld pages again in %ld ns\n", pages, w2time);
 
-            ratio = w2time / wtime;
-            vm_stat = (ratio > _ksmthresh) ? TRUE : FALSE;
+            /* Fixed-point ratio, so 1.94 is not truncated to 1; the Receiver has no first write */
+            ratio = (wtime > 0) ? div64_u64((uint64_t) w2time * RATIO_SCALE, wtime) : 0;
 
-            printk("<memdupe> Ratio = %ld = %ld / %ld, Threshold = %d, VM_Status = %d\n",
-                   ratio, w2time, wtime, _ksmthresh, vm_stat);
+            /*
+             * Either the totals slowed down, or a cluster of pages took a COW fault. A lone slow
+             * page splits off too, and an interrupt or vmexit is enough to cause one, so the
+             * cluster must be a real share of the pages before it counts.
+             */
+            vm_stat = (ratio > cfg->ksmthresh * RATIO_SCALE ||
+                       (cls.split && cls.nlong * CLUSTER_DIV * cfg->ksmthresh >= pages)) ? TRUE : FALSE;
+
+            printk("<memdupe> Ratio = %ld.%03ld = %ld / %ld, Threshold = %d, VM_Status = %d\n",
+                   ratio / RATIO_SCALE, ratio % RATIO_SCALE, w2time, wtime, cfg->ksmthresh, vm_stat);
 
             if (vm_stat) {
                 printk("<memdupe> Memory deduplication probably occurred\n");
             } else {
                 printk("<memdupe> Memory deduplication did not occur\n");
             }
+        }
 
-            // Avoid memory leaks...
-            free_data(fsize, &data0, &data1, &data2);
-            printk("<memdupe> Freed data pointers\n");
+        /* Publish the results */
+        mutex_lock(&_resultlock);
+        if (stopped) {
+            _result.stopped++;
+        } else {
+            _result.runs++;
+            _result.role = cfg->role;
+            _result.pages = (timings != NULL) ? pages : 0;
+            _result.wtime = wtime;
+            _result.w2time = w2time;
+            _result.ratio = ratio;
+            _result.vm_stat = vm_stat;
+            _result.cls = cls;
+            swap(_result.timings, timings);
         }
+        mutex_unlock(&_resultlock);
+
+        // Avoid memory leaks...
+        vfree(timings);
+        free_data(fsize, &data0);
+        printk("<memdupe> Freed data pointers\n");
     }
+    kfree(cfg);
 
-    return vm_stat;
+    return stopped ? -EINTR : vm_stat;
+}
+
+/**
+ * round_work
+ * @brief One measurement round on the unbound workqueue. Wakes every waiter when done,
+ *        then queues the next round after period seconds unless stopped.
+ * @param work The round's delayed work
+ */
+static void round_work(struct work_struct *work) {
+    int period;
+
+    reinit_completion(&_done);
+    WRITE_ONCE(_state, KMEMDUPE_RUNNING);
+    memdupe_run();
+    WRITE_ONCE(_state, KMEMDUPE_IDLE);
+    complete_all(&_done);
+
+    period = READ_ONCE(_period);
+    if (period > 0 && !READ_ONCE(_stop)) {
+        queue_delayed_work(_wq, &_round, msecs_to_jiffies(min(period, KMEMDUPE_MAX_SECONDS) * 1000));
+    }
+}
+
+/**
+ * run_write
+ * @brief Writing anything to debugfs run starts measuring: one round, or periodic rounds
+ *        until stop if period is set. Returns at once.
+ * @return count, or -EBUSY if rounds are already running or scheduled
+ */
+static ssize_t run_write(struct file *fp, const char __user *buf, size_t count, loff_t *pos) {
+    if (READ_ONCE(_state) == KMEMDUPE_RUNNING) {
+        return -EBUSY;
+    }
+    WRITE_ONCE(_stop, FALSE);
+    reinit_completion(&_done);
+
+    return queue_delayed_work(_wq, &_round, 0) ? count : -EBUSY;
+}
+
+/**
+ * stop_write
+ * @brief Writing anything to debugfs stop cancels the next round and ends the current
+ *        round's wait early. It returns once that round has finished: a round that read
+ *        _stop just before it was set may still re-queue itself, and the synchronous
+ *        cancel blocks that too.
+ * @return count
+ */
+static ssize_t stop_write(struct file *fp, const char __user *buf, size_t count, loff_t *pos) {
+    WRITE_ONCE(_stop, TRUE);
+    wake_up_interruptible(&_stopq);
+    if (cancel_delayed_work_sync(&_round)) {
+        complete_all(&_done);
+    }
+
+    return count;
+}
+
+/**
+ * status_show
+ * @brief debugfs status: run state and the parameters the next run will use.
+ */
+static int status_show(struct seq_file *m, void *v) {
+    seq_printf(m, "state: %s\n", (READ_ONCE(_state) == KMEMDUPE_RUNNING) ? "running" :
+               delayed_work_pending(&_round) ? "scheduled" : "idle");
+    seq_printf(m, "runs: %ld\nstopped: %ld\n", _result.runs, _result.stopped);
+    kernel_param_lock(THIS_MODULE);
+    seq_printf(m, "role: %d\nsleeptime: %d\nperiod: %d\nfilepath: %s\nthreshold: %d\nreadtwice: %d\n"
+               "classifier: %s\n", _vmrole, _sleeptime, _period, _filepath, _ksmthresh, _readtwice,
+               classify_name(_classifier));
+    kernel_param_unlock(THIS_MODULE);
+
+    return 0;
+}
+
+/**
+ * results_show
+ * @brief debugfs results: the last completed run, one key per line.
+ */
+static int results_show(struct seq_file *m, void *v) {
+    mutex_lock(&_resultlock);
+    seq_printf(m, "role: %d\n", _result.role);
+    seq_printf(m, "run: %ld\npages: %ld\nwtime_ns: %ld\nw2time_ns: %ld\nratio: %ld.%03ld\nvm_stat: %d\n",
+               _result.runs, _result.pages, _result.wtime, _result.w2time,
+               _result.ratio / RATIO_SCALE, _result.ratio % RATIO_SCALE, _result.vm_stat);
+    seq_printf(m, "classifier: %s\nsplit: %d\nthreshold_ns: %llu\nmedian_ns: %llu\nlong: %ld\n"
+               "weak: %ld\nconfidence: %u.%u%%\n",
+               classify_name(_result.cls.method), _result.cls.split, ticks_to_ns(_result.cls.threshold),
+               ticks_to_ns(_result.cls.median), _result.cls.nlong, _result.cls.nweak,
+               _result.cls.conf / 10, _result.cls.conf % 10);
+    mutex_unlock(&_resultlock);
+
+    return 0;
+}
+
+/**
+ * timings_read
+ * @brief debugfs timings: the last run's second-write time of each page, as raw u64 ns.
+ */
+static ssize_t timings_read(struct file *fp, char __user *buf, size_t count, loff_t *pos) {
+    ssize_t ret;
+
+    mutex_lock(&_resultlock);
+    ret = simple_read_from_buffer(buf, count, pos, _result.timings, _result.pages * sizeof(uint64_t));
+    mutex_unlock(&_resultlock);
+
+    return ret;
+}
+
+/**
+ * ksmwalk_pmd
+ * @brief Record the pages mapped by one PMD, under its page table lock.
+ * @param w Walk
+ * @param mm Address space
+ * @param pmd PMD covering addr
+ * @param addr First address
+ * @param end End of the PMD's range
+ */
+static void ksmwalk_pmd(struct ksmwalk *w, struct mm_struct *mm, pmd_t *pmd, ulong addr, ulong end) {
+    struct ksmwalk_entry *e;
+    struct page *page;
+    spinlock_t *ptl;
+    pte_t *ptep, *pte;
+
+    ptep = pte_offset_map_lock(mm, pmd, addr, &ptl);
+    for (pte = ptep; addr < end; addr += PAGE_SIZE, pte++) {
+        if (!pte_present(*pte)) {
+            continue;
+        }
+
+        e = &w->entries[(addr - w->start) >> PAGE_SHIFT];
+        e->pfn = pte_pfn(*pte);
+        e->flags = KSMWALK_PRESENT;
+        if (is_zero_pfn(e->pfn)) {
+            e->flags |= KSMWALK_ZERO;
+        } else if (pfn_valid(e->pfn)) {
+            page = pfn_to_page(e->pfn);
+            e->flags |= PageKsm(page) ? KSMWALK_KSM : 0;
+            e->mapcount = page_mapcount(page);
+        }
+    }
+    pte_unmap_unlock(ptep, ptl);
+}
+
+/**
+ * ksmwalk_range
+ * @brief Walk the page tables of a range read-only, one PMD at a time. Nothing is faulted
+ *        in, so the walk does not disturb the merges it reports; absent pages stay zero.
+ * @param w Walk, with start, pages and zeroed entries set
+ * @param mm Address space, mmap_sem held for read
+ */
+static void ksmwalk_range(struct ksmwalk *w, struct mm_struct *mm) {
+    ulong end = w->start + w->pages * PAGE_SIZE;
+    ulong addr, next, i;
+    pgd_t *pgd;
+    p4d_t *p4d;
+    pud_t *pud;
+    pmd_t *pmd;
+
+    for (addr = w->start; addr < end; addr = next) {
+        next = pmd_addr_end(addr, end);
+
+        pgd = pgd_offset(mm, addr);
+        if (pgd_none(*pgd) || pgd_bad(*pgd)) {
+            continue;
+        }
+        p4d = p4d_offset(pgd, addr);
+        if (p4d_none(*p4d) || p4d_bad(*p4d)) {
+            continue;
+        }
+        pud = pud_offset(p4d, addr);
+        if (pud_none(*pud) || pud_bad(*pud) || pud_trans_huge(*pud)) {
+            continue;
+        }
+        pmd = pmd_offset(pud, addr);
+        if (pmd_trans_huge(*pmd)) {
+            /* THP: present, but KSM only ever merges small pages */
+            for (i = (addr - w->start) >> PAGE_SHIFT; i < (next - w->start) >> PAGE_SHIFT; i++) {
+                w->entries[i].pfn = pmd_pfn(*pmd) + ((w->start + i * PAGE_SIZE) & ~PMD_MASK) / PAGE_SIZE;
+                w->entries[i].flags = KSMWALK_PRESENT | KSMWALK_HUGE;
+            }
+            continue;
+        }
+        if (pmd_none(*pmd) || pmd_bad(*pmd)) {
+            continue;
+        }
+
+        ksmwalk_pmd(w, mm, pmd, addr, next);
+    }
+
+    for (i = 0; i < w->pages; i++) {
+        w->present += (w->entries[i].flags & KSMWALK_PRESENT) != 0;
+        w->ksm += (w->entries[i].flags & KSMWALK_KSM) != 0;
+        w->zero += (w->entries[i].flags & KSMWALK_ZERO) != 0;
+        w->shared += (w->entries[i].mapcount > 1);
+    }
+}
+
+/**
+ * ksmwalk_write
+ * @brief Writing "PID START END" to debugfs ksmwalk walks that range of the process's
+ *        page tables and replaces the last walk. Addresses may be hex with 0x.
+ * @return count, or a negative error
+ */
+static ssize_t ksmwalk_write(struct file *fp, const char __user *buf, size_t count, loff_t *pos) {
+    struct ksmwalk_entry *entries;
+    struct task_struct *task;
+    struct mm_struct *mm;
+    struct ksmwalk w = {0};
+    long start, end;
+    char *cmd;
+    int pid;
+
+    cmd = memdup_user_nul(buf, count);
+    if (IS_ERR(cmd)) {
+        return PTR_ERR(cmd);
+    }
+    if (sscanf(cmd, "%d %li %li", &pid, &start, &end) != 3 || start < 0 || end <= start) {
+        kfree(cmd);
+        return -EINVAL;
+    }
+    kfree(cmd);
+
+    w.pid = pid;
+    w.start = start & PAGE_MASK;
+    w.pages = (PAGE_ALIGN(end) - w.start) >> PAGE_SHIFT;
+    if (w.pages > KSMWALK_MAX) {
+        return -E2BIG;
+    }
+
+    rcu_read_lock();
+    task = pid_task(find_vpid(pid), PIDTYPE_PID);
+    if (task != NULL) {
+        get_task_struct(task);
+    }
+    rcu_read_unlock();
+    if (task == NULL) {
+        return -ESRCH;
+    }
+    mm = get_task_mm(task);
+    put_task_struct(task);
+    if (mm == NULL) {
+        return -EINVAL;
+    }
+
+    w.entries = (struct ksmwalk_entry *) vzalloc(w.pages * sizeof(struct ksmwalk_entry));
+    if (w.entries == NULL) {
+        mmput(mm);
+        return -ENOMEM;
+    }
+
+    down_read(&mm->mmap_sem);
+    ksmwalk_range(&w, mm);
+    up_read(&mm->mmap_sem);
+    mmput(mm);
+
+    printk("<memdupe> Walked %ld pages of pid %d from 0x%lx: %ld present, %ld KSM, %ld zero, %ld shared\n",
+           w.pages, w.pid, w.start, w.present, w.ksm, w.zero, w.shared);
+
+    mutex_lock(&_walklock);
+    entries = _walk.entries;
+    _walk = w;
+    mutex_unlock(&_walklock);
+    vfree(entries);
+
+    return count;
+}
+
+/* debugfs ksmwalk is read as CSV, one line per page, holding _walklock throughout */
+static void *ksmwalk_start(struct seq_file *m, loff_t *pos) {
+    mutex_lock(&_walklock);
+    if (*pos == 0) {
+        return SEQ_START_TOKEN;
+    }
+
+    return (*pos <= _walk.pages) ? &_walk.entries[*pos - 1] : NULL;
+}
+
+static void *ksmwalk_next(struct seq_file *m, void *v, loff_t *pos) {
+    (*pos)++;
+
+    return (*pos <= _walk.pages) ? &_walk.entries[*pos - 1] : NULL;
+}
+
+static void ksmwalk_stop(struct seq_file *m, void *v) {
+    mutex_unlock(&_walklock);
+}
+
+static int ksmwalk_show(struct seq_file *m, void *v) {
+    struct ksmwalk_entry *e = (struct ksmwalk_entry *) v;
+    ulong index;
+
+    if (v == SEQ_START_TOKEN) {
+        seq_puts(m, "Page,Addr,PFN,Present?,KSM?,Zero?,Huge?,Mapcount\n");
+        return 0;
+    }
+
+    index = e - _walk.entries;
+    seq_printf(m, "%lu,0x%lx,0x%lx,%u,%u,%u,%u,%d\n", index, _walk.start + index * PAGE_SIZE, e->pfn,
+               (e->flags & KSMWALK_PRESENT) != 0, (e->flags & KSMWALK_KSM) != 0,
+               (e->flags & KSMWALK_ZERO) != 0, (e->flags & KSMWALK_HUGE) != 0, e->mapcount);
+
+    return 0;
+}
+
+static const struct seq_operations ksmwalk_seqops = {
+    .start = ksmwalk_start,
+    .next = ksmwalk_next,
+    .stop = ksmwalk_stop,
+    .show = ksmwalk_show,
+};
+
+static int ksmwalk_open(struct inode *inode, struct file *fp) {
+    return seq_open(fp, &ksmwalk_seqops);
+}
+
+static int status_open(struct inode *inode, struct file *fp) {
+    return single_open(fp, status_show, NULL);
+}
+
+static int results_open(struct inode *inode, struct file *fp) {
+    return single_open(fp, results_show, NULL);
+}
+
+/**
+ * wait_open
+ * @brief debugfs wait: block until the current round completes, then show its results.
+ *        Returns at once when no round is running.
+ */
+static int wait_open(struct inode *inode, struct file *fp) {
+    if (wait_for_completion_interruptible(&_done) != 0) {
+        return -ERESTARTSYS;
+    }
+
+    return single_open(fp, results_show, NULL);
+}
+
+static const struct file_operations run_fops = {
+    .owner = THIS_MODULE,
+    .write = run_write,
+};
+
+static const struct file_operations stop_fops = {
+    .owner = THIS_MODULE,
+    .write = stop_write,
+};
+
+static const struct file_operations status_fops = {
+    .owner = THIS_MODULE,
+    .open = status_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations results_fops = {
+    .owner = THIS_MODULE,
+    .open = results_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations wait_fops = {
+    .owner = THIS_MODULE,
+    .open = wait_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations ksmwalk_fops = {
+    .owner = THIS_MODULE,
+    .open = ksmwalk_open,
+    .read = seq_read,
+    .write = ksmwalk_write,
+    .llseek = seq_lseek,
+    .release = seq_release,
+};
+
+static const struct file_operations timings_fops = {
+    .owner = THIS_MODULE,
+    .read = timings_read,
+    .llseek = default_llseek,
+};
+
+static int __init memdupe_init(void) {
+    uint cpl_flag = 0;
+
+    /* Check CPL flag */
+    cpl_flag = cpl_check();
+
+    if (cpl_flag == CPL_KERN) {
+        printk("<memdupe> Running memdupe_init in kernel mode\n");
+
+        /* Rounds sleep for seconds, so they get their own unbound queue, one at a time */
+        _wq = alloc_workqueue("kmemdupe", WQ_UNBOUND, 1);
+        if (_wq == NULL) {
+            printk("<memdupe> Error allocating workqueue\n");
+            return -ENOMEM;
+        }
+        complete_all(&_done);
+
+        /* Control surface: /sys/kernel/debug/kmemdupe */
+        _debugfs = debugfs_create_dir("kmemdupe", NULL);
+        if (IS_ERR_OR_NULL(_debugfs)) {
+            printk("<memdupe> Warning: debugfs unavailable, only autorun will measure\n");
+            _debugfs = NULL;
+        } else {
+            debugfs_create_file("run", 0200, _debugfs, NULL, &run_fops);
+            debugfs_create_file("stop", 0200, _debugfs, NULL, &stop_fops);
+            debugfs_create_file("status", 0444, _debugfs, NULL, &status_fops);
+            debugfs_create_file("results", 0444, _debugfs, NULL, &results_fops);
+            debugfs_create_file("wait", 0444, _debugfs, NULL, &wait_fops);
+            debugfs_create_file("timings", 0444, _debugfs, NULL, &timings_fops);
+            debugfs_create_file("ksmwalk", 0600, _debugfs, NULL, &ksmwalk_fops);
+        }
+
+        /* Measure in the background, so insmod returns at once */
+        if (_autorun) {
+            reinit_completion(&_done);
+            queue_delayed_work(_wq, &_round, 0);
+        }
+    }
+
+    return 0;
 }
 
 static void __exit memdupe_exit(void) {
+    /* End any round and release the waiters, since removing the files waits for their opens */
+    WRITE_ONCE(_stop, TRUE);
+    wake_up_interruptible(&_stopq);
+    if (_wq != NULL) {
+        cancel_delayed_work_sync(&_round);
+    }
+    complete_all(&_done);
+    debugfs_remove_recursive(_debugfs);
+
+    /* Cancel a round started in the meantime the same way, even if it queues itself again */
+    if (_wq != NULL) {
+        WRITE_ONCE(_stop, TRUE);
+        wake_up_interruptible(&_stopq);
+        cancel_delayed_work_sync(&_round);
+        destroy_workqueue(_wq);
+    }
+
+    vfree(_result.timings);
+    vfree(_walk.entries);
     printk("<memdupe> Done\n");
 }
 
@@ -0,0 +1,439 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file ksmemu.c
+ * @headerfile ksmemu.h
+ * @brief Userspace KSM emulator for testing the channel without KVM or ksmd. Each emulated
+ *        region lives in its own POSIX shared memory object, listed in a shared slot table,
+ *        so separately started Sender, Receiver and Tester processes see each other's pages.
+ *        A scanner thread in every process hashes its own pages, and a page that stays
+ *        unchanged across two scans and equals the same page of another region is merged:
+ *        write-protected. The next write faults, and the SIGSEGV handler busy-waits for the
+ *        configured penalty before restoring write access, standing in for the kernel's COW.
+ * @date 10-17-2026
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "ksmemu.h"
+
+#define KSMEMU_NAME 64
+#define FNV_PRIME   0x100000001b3ULL
+
+static struct ksmemu *_emu;
+
+/**
+ * ksmemu_now
+ * @return CLOCK_MONOTONIC time (ns)
+ */
+static long ksmemu_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * ksmemu_fault
+ * @brief SIGSEGV handler: a write to a write-protected page of an emulated region breaks
+ *        the merge. Merged pages pay the penalty; pages caught mid-comparison do not.
+ *        Faults outside the regions get the default action on return.
+ */
+static void ksmemu_fault(int sig, siginfo_t *info, void *ctx) {
+    struct ksmemu_region *r;
+    char *addr = (char *) info->si_addr;
+    unsigned long p;
+    long until;
+    int i;
+
+    (void) ctx;
+    for (i = 0; i < KSMEMU_SLOTS; i++) {
+        r = &_emu->region[i];
+        if (r->id < 0 || addr < r->data || addr >= r->data + r->pages * _emu->pagesize) {
+            continue;
+        }
+
+        p = (addr - r->data) / _emu->pagesize;
+        if (__sync_lock_test_and_set(&r->state[p], KSMEMU_UNMERGED) == KSMEMU_MERGED) {
+            until = ksmemu_now() + _emu->penalty;
+            while (ksmemu_now() < until);
+            __sync_fetch_and_sub(&_emu->arena->slot[r->id].merged, 1);
+            __sync_fetch_and_add(&_emu->arena->slot[r->id].faults, 1);
+        }
+        mprotect(r->data + p * _emu->pagesize, _emu->pagesize, PROT_READ | PROT_WRITE);
+        return;
+    }
+
+    signal(sig, SIG_DFL);
+}
+
+/**
+ * ksmemu_hash
+ * @param page Page to hash
+ * @param pagesize Bytes per page
+ * @return 64-bit FNV-1a style hash over the page's words
+ */
+static uint64_t ksmemu_hash(const char *page, size_t pagesize) {
+    const uint64_t *word = (const uint64_t *) page;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < pagesize / sizeof(uint64_t); i++) {
+        h = (h ^ word[i]) * FNV_PRIME;
+    }
+
+    return h;
+}
+
+/**
+ * ksmemu_peers
+ * @brief Map every newly claimed slot read-only and drop slots that were released.
+ * @param emu Emulator
+ */
+static void ksmemu_peers(struct ksmemu *emu) {
+    struct ksmemu_slot *slot;
+    char name[KSMEMU_NAME];
+    void *view;
+    int i, fd;
+
+    for (i = 0; i < KSMEMU_SLOTS; i++) {
+        slot = &emu->arena->slot[i];
+        if (emu->peer[i] != NULL && emu->peerpid[i] != slot->pid) {
+            if (emu->region[i].id < 0) {
+                munmap(emu->peer[i], emu->peerpages[i] * emu->pagesize);
+            }
+            free(emu->peerhash[i]);
+            emu->peerhash[i] = NULL;
+            emu->peer[i] = NULL;
+        }
+
+        if (emu->peer[i] != NULL || slot->pid == 0 || slot->pages == 0) {
+            continue;
+        }
+
+        if (emu->region[i].id == i) {
+            emu->peer[i] = emu->region[i].data;
+        } else {
+            snprintf(name, sizeof(name), KSMEMU_SLOT, i);
+            fd = shm_open(name, O_RDONLY, 0);
+            if (fd < 0) {
+                continue;
+            }
+            view = mmap(NULL, slot->pages * emu->pagesize, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (view == MAP_FAILED) {
+                continue;
+            }
+            emu->peer[i] = (char *) view;
+        }
+        emu->peerpages[i] = slot->pages;
+        emu->peerpid[i] = slot->pid;
+        emu->peerhash[i] = (uint64_t *) calloc(slot->pages, sizeof(uint64_t));
+    }
+}
+
+/**
+ * ksmemu_merge
+ * @brief Try to merge one stable page with the same page of any other region: write-protect
+ *        it first, then compare, so a racing write either lands before the comparison or
+ *        faults and cancels the merge. Like ksmd's unstable tree, the peer's page must be
+ *        unchanged too: its hash has to match the one taken the last time this page was a
+ *        candidate. Peer hashes are tracked on every scan, even while this page is still
+ *        settling, so both sides can become stable on the same scan.
+ * @param emu Emulator
+ * @param r Region owning the page
+ * @param p Page index
+ * @param stable Whether this page is unchanged since the previous scan
+ */
+static void ksmemu_merge(struct ksmemu *emu, struct ksmemu_region *r, unsigned long p, int stable) {
+    char *page = r->data + p * emu->pagesize;
+    uint64_t h;
+    int i;
+
+    for (i = 0; i < KSMEMU_SLOTS; i++) {
+        if (i == r->id || emu->peer[i] == NULL || emu->peerhash[i] == NULL || emu->peerpages[i] <= p) {
+            continue;
+        }
+
+        h = ksmemu_hash(emu->peer[i] + p * emu->pagesize, emu->pagesize);
+        if (h != emu->peerhash[i][p]) {
+            emu->peerhash[i][p] = h;
+            continue;
+        }
+        if (!stable || memcmp(page, emu->peer[i] + p * emu->pagesize, emu->pagesize) != 0) {
+            continue;
+        }
+
+        r->state[p] = KSMEMU_MERGING;
+        mprotect(page, emu->pagesize, PROT_READ);
+
+        if (memcmp(page, emu->peer[i] + p * emu->pagesize, emu->pagesize) == 0 &&
+            __sync_bool_compare_and_swap(&r->state[p], KSMEMU_MERGING, KSMEMU_MERGED)) {
+            __sync_fetch_and_add(&emu->arena->slot[r->id].merged, 1);
+        } else if (__sync_bool_compare_and_swap(&r->state[p], KSMEMU_MERGING, KSMEMU_UNMERGED)) {
+            mprotect(page, emu->pagesize, PROT_READ | PROT_WRITE);
+        }
+        return;
+    }
+}
+
+/**
+ * ksmemu_scan
+ * @brief Scanner thread: one pass over this process's regions per KSMEMU_SCAN_MS.
+ * @param arg The emulator
+ * @return NULL
+ */
+static void *ksmemu_scan(void *arg) {
+    struct ksmemu *emu = (struct ksmemu *) arg;
+    struct ksmemu_region *r;
+    struct timespec pause = {0, KSMEMU_SCAN_MS * 1000000L};
+    unsigned long p;
+    uint64_t h;
+    int i;
+
+    while (!emu->quit) {
+        ksmemu_peers(emu);
+
+        for (i = 0; i < KSMEMU_SLOTS; i++) {
+            r = &emu->region[i];
+            if (r->id < 0) {
+                continue;
+            }
+
+            for (p = 0; p < r->pages && !emu->quit; p++) {
+                if (r->state[p] != KSMEMU_UNMERGED) {
+                    continue;
+                }
+
+                /* Like ksmd, only pages unchanged since the previous scan are candidates */
+                h = ksmemu_hash(r->data + p * emu->pagesize, emu->pagesize);
+                ksmemu_merge(emu, r, p, h == r->hash[p]);
+                r->hash[p] = h;
+            }
+            emu->arena->slot[r->id].scans++;
+        }
+
+        emu->scans++;
+        nanosleep(&pause, NULL);
+    }
+
+    return NULL;
+}
+
+/**
+ * ksmemu_init
+ * @brief Attach to the shared slot table, install the fault handler and start the scanner.
+ * @param emu Emulator to initialize
+ * @param penalty Busy-wait per broken merge (ns)
+ * @param pagesize Bytes per page
+ * @return 0 on success, -1 on failure
+ */
+int ksmemu_init(struct ksmemu *emu, long penalty, size_t pagesize) {
+    struct sigaction sa;
+    void *arena;
+    int i, fd;
+
+    memset(emu, 0, sizeof(*emu));
+    for (i = 0; i < KSMEMU_SLOTS; i++) {
+        emu->region[i].id = -1;
+    }
+    emu->penalty = penalty;
+    emu->pagesize = pagesize;
+
+    fd = shm_open(KSMEMU_ARENA, O_CREAT | O_RDWR, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(struct ksmemu_arena)) < 0) {
+        printf("<memdupe> Error opening KSM emulator arena '%s': %s\n", KSMEMU_ARENA, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    arena = mmap(NULL, sizeof(struct ksmemu_arena), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (arena == MAP_FAILED) {
+        return -1;
+    }
+    emu->arena = (struct ksmemu_arena *) arena;
+
+    _emu = emu;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = ksmemu_fault;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+
+    if (pthread_create(&emu->scanner, NULL, ksmemu_scan, emu) != 0) {
+        munmap(emu->arena, sizeof(struct ksmemu_arena));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * ksmemu_free
+ * @brief Stop the scanner and release this process's slots. The regions themselves stay
+ *        mapped; the caller unmaps them like any other carrier.
+ * @param emu Emulator
+ */
+void ksmemu_free(struct ksmemu *emu) {
+    struct ksmemu_region *r;
+    char name[KSMEMU_NAME];
+    int i;
+
+    if (emu->arena == NULL) {
+        return;
+    }
+
+    emu->quit = 1;
+    pthread_join(emu->scanner, NULL);
+
+    for (i = 0; i < KSMEMU_SLOTS; i++) {
+        r = &emu->region[i];
+        if (emu->peer[i] != NULL && r->id < 0) {
+            munmap(emu->peer[i], emu->peerpages[i] * emu->pagesize);
+        }
+        free(emu->peerhash[i]);
+        emu->peerhash[i] = NULL;
+        if (r->id >= 0) {
+            snprintf(name, sizeof(name), KSMEMU_SLOT, r->id);
+            shm_unlink(name);
+            emu->arena->slot[r->id].pages = 0;
+            emu->arena->slot[r->id].pid = 0;
+            free(r->hash);
+            free((void *) r->state);
+        }
+    }
+
+    munmap(emu->arena, sizeof(struct ksmemu_arena));
+    emu->arena = NULL;
+}
+
+/**
+ * ksmemu_claim
+ * @brief Claim a free slot, reclaiming slots left behind by processes that have exited.
+ * @param emu Emulator
+ * @return Slot index, -1 if all are taken
+ */
+static int ksmemu_claim(struct ksmemu *emu) {
+    struct ksmemu_slot *slot;
+    int i, pid;
+
+    for (i = 0; i < KSMEMU_SLOTS; i++) {
+        slot = &emu->arena->slot[i];
+        pid = slot->pid;
+        if ((pid == 0 || (kill(pid, 0) < 0 && errno == ESRCH)) &&
+            __sync_bool_compare_and_swap(&slot->pid, pid, getpid())) {
+            slot->pages = 0;
+            slot->scans = slot->merged = slot->faults = 0;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * ksmemu_adopt
+ * @brief Move a loaded carrier into an emulated region. The private copy is unmapped.
+ * @param emu Emulator
+ * @param data Carrier
+ * @param size Carrier size (bytes)
+ * @return The region holding the carrier, or data unchanged if no region could be made
+ */
+char *ksmemu_adopt(struct ksmemu *emu, char *data, unsigned long size) {
+    struct ksmemu_region *r;
+    char name[KSMEMU_NAME];
+    unsigned long pages = size / emu->pagesize;
+    void *region;
+    int id, fd;
+
+    if (data == NULL || (id = ksmemu_claim(emu)) < 0) {
+        return data;
+    }
+
+    snprintf(name, sizeof(name), KSMEMU_SLOT, id);
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        printf("<memdupe> Error creating emulated region '%s'\n", name);
+        if (fd >= 0) {
+            close(fd);
+        }
+        emu->arena->slot[id].pid = 0;
+        return data;
+    }
+
+    region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        printf("<memdupe> Error mapping emulated region '%s'\n", name);
+        shm_unlink(name);
+        emu->arena->slot[id].pid = 0;
+        return data;
+    }
+
+    memcpy(region, data, size);
+    munmap(data, size);
+
+    r = &emu->region[id];
+    r->data = (char *) region;
+    r->pages = pages;
+    r->hash = (uint64_t *) calloc(pages, sizeof(uint64_t));
+    r->state = (volatile uint8_t *) calloc(pages, sizeof(uint8_t));
+    __sync_synchronize();
+    r->id = id;
+    emu->arena->slot[id].pages = pages;
+
+    return r->data;
+}
+
+/**
+ * ksmemu_wait
+ * @brief Block until the scanner completes nscans more full scans, not counting the one
+ *        in progress.
+ * @param emu Emulator
+ * @param nscans Full scans to wait for
+ * @return Nanoseconds waited
+ */
+long ksmemu_wait(struct ksmemu *emu, unsigned long nscans) {
+    struct timespec pause = {0, KSMEMU_SCAN_MS * 1000000L / 4};
+    unsigned long target = emu->scans + nscans + 1;
+    long start = ksmemu_now();
+
+    while (emu->scans < target) {
+        nanosleep(&pause, NULL);
+    }
+
+    return ksmemu_now() - start;
+}
+
+/**
+ * ksmemu_merged
+ * @param emu Emulator
+ * @param faults Set to the number of merges broken by writes
+ * @return Pages of this process's regions currently merged
+ */
+unsigned long ksmemu_merged(struct ksmemu *emu, unsigned long *faults) {
+    unsigned long merged = 0;
+    int i;
+
+    *faults = 0;
+    for (i = 0; i < KSMEMU_SLOTS; i++) {
+        if (emu->region[i].id >= 0) {
+            merged += emu->arena->slot[emu->region[i].id].merged;
+            *faults += emu->arena->slot[emu->region[i].id].faults;
+        }
+    }
+
+    return merged;
+}
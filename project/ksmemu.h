@@ -0,0 +1,64 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file ksmemu.h
+ * @brief Userspace KSM emulator for testing the channel without KVM or ksmd.
+ * @date 10-17-2026
+ */
+#ifndef _KSMEMU_H_
+#define _KSMEMU_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define KSMEMU_ARENA   "/memdupe-ksmemu"     /* Shared slot table (POSIX shared memory) */
+#define KSMEMU_SLOT    "/memdupe-ksmemu.%d"  /* Pages of one emulated region */
+#define KSMEMU_SLOTS   8                     /* Regions across all processes */
+#define KSMEMU_SCAN_MS 20                    /* Pause between scans, like sleep_millisecs */
+
+/* Page states */
+#define KSMEMU_UNMERGED 0
+#define KSMEMU_MERGING  1   /* Write-protected while it is compared */
+#define KSMEMU_MERGED   2   /* Write-protected; the next write pays the COW penalty */
+
+struct ksmemu_slot {
+    volatile int pid;                   /* Owner, 0 if free */
+    volatile unsigned long pages;
+    volatile unsigned long scans;       /* Full scans of this slot completed */
+    volatile unsigned long merged;      /* Pages currently merged */
+    volatile unsigned long faults;      /* Writes that broke a merge */
+};
+
+struct ksmemu_arena {
+    struct ksmemu_slot slot[KSMEMU_SLOTS];
+};
+
+struct ksmemu_region {
+    int id;                             /* Slot index, -1 if unused */
+    char *data;
+    unsigned long pages;
+    uint64_t *hash;                     /* Page hash from the previous scan */
+    volatile uint8_t *state;            /* KSMEMU_UNMERGED, _MERGING or _MERGED per page */
+};
+
+struct ksmemu {
+    struct ksmemu_arena *arena;
+    struct ksmemu_region region[KSMEMU_SLOTS];  /* Regions owned by this process */
+    char *peer[KSMEMU_SLOTS];                   /* Views of every claimed slot, local or not */
+    unsigned long peerpages[KSMEMU_SLOTS];
+    int peerpid[KSMEMU_SLOTS];
+    uint64_t *peerhash[KSMEMU_SLOTS];           /* Hash of each peer page when last compared */
+    long penalty;                               /* Busy-wait per broken merge (ns) */
+    size_t pagesize;
+    pthread_t scanner;
+    volatile unsigned long scans;               /* Full scans of this process's regions */
+    volatile int quit;
+};
+
+int ksmemu_init(struct ksmemu *emu, long penalty, size_t pagesize);
+void ksmemu_free(struct ksmemu *emu);
+char *ksmemu_adopt(struct ksmemu *emu, char *data, unsigned long size);
+long ksmemu_wait(struct ksmemu *emu, unsigned long nscans);
+unsigned long ksmemu_merged(struct ksmemu *emu, unsigned long *faults);
+
+#endif
@@ -0,0 +1,129 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file ksmmon.c
+ * @headerfile ksmmon.h
+ * @brief KSM monitor: poll ksmd's scan progress in /sys/kernel/mm/ksm. Waiting for whole
+ *        scans instead of a fixed sleep advances as soon as ksmd has had the chance to
+ *        merge, however fast or slow it is configured.
+ * @date 10-17-2026
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "ksmmon.h"
+
+#define KSM_LINE 32
+
+static const char *_names[KSM_NSTATS] = {
+    "full_scans", "pages_shared", "pages_sharing", "pages_to_scan", "sleep_millisecs", "run"
+};
+
+/**
+ * ksmmon_open
+ * @brief Open every counter and take a first reading.
+ * @param mon Monitor to initialize
+ * @return 0 on success, -1 if KSM is missing or not running
+ */
+int ksmmon_open(struct ksmmon *mon) {
+    char path[BUFSIZ];
+    int i;
+
+    for (i = 0; i < KSM_NSTATS; i++) {
+        mon->fd[i] = -1;
+    }
+
+    for (i = 0; i < KSM_NSTATS; i++) {
+        snprintf(path, sizeof(path), "%s%s", KSM_SYSFS, _names[i]);
+        mon->fd[i] = open(path, O_RDONLY);
+        if (mon->fd[i] < 0) {
+            ksmmon_close(mon);
+            return -1;
+        }
+    }
+
+    if (ksmmon_read(mon) < 0 || mon->stat[KSM_RUN] != 1) {
+        ksmmon_close(mon);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * ksmmon_close
+ * @brief Close the counters.
+ * @param mon Monitor
+ */
+void ksmmon_close(struct ksmmon *mon) {
+    int i;
+
+    for (i = 0; i < KSM_NSTATS; i++) {
+        if (mon->fd[i] >= 0) {
+            close(mon->fd[i]);
+        }
+        mon->fd[i] = -1;
+    }
+}
+
+/**
+ * ksmmon_read
+ * @brief Re-read every counter from offset 0 of its open file.
+ * @param mon Monitor
+ * @return 0 on success, -1 on a failed read
+ */
+int ksmmon_read(struct ksmmon *mon) {
+    char line[KSM_LINE];
+    ssize_t n;
+    int i;
+
+    for (i = 0; i < KSM_NSTATS; i++) {
+        n = pread(mon->fd[i], line, sizeof(line) - 1, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        line[n] = '\0';
+        mon->stat[i] = strtoul(line, NULL, 10);
+    }
+
+    return 0;
+}
+
+/**
+ * ksmmon_wait
+ * @brief Block until ksmd completes nscans more full scans. The scan in progress may
+ *        already have passed the pages just written, so it is not counted. Polls once per ksmd batch
+ *        (sleep_millisecs, clamped), so a fast ksmd is followed closely and a slow one
+ *        is not polled needlessly.
+ * @param mon Monitor
+ * @param nscans Full scans to wait for
+ * @param timeout Seconds before giving up
+ * @return Nanoseconds waited, or -1 on timeout or a failed read
+ */
+long ksmmon_wait(struct ksmmon *mon, unsigned long nscans, int timeout) {
+    struct timespec start, now, poll;
+    unsigned long target = mon->stat[KSM_FULL_SCANS] + nscans + 1;
+    unsigned long ms;
+    long waited = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (mon->stat[KSM_FULL_SCANS] < target) {
+        ms = mon->stat[KSM_SLEEP_MILLISECS];
+        ms = (ms < KSMMON_POLL_MIN) ? KSMMON_POLL_MIN : (ms > KSMMON_POLL_MAX) ? KSMMON_POLL_MAX : ms;
+        poll.tv_sec = ms / 1000;
+        poll.tv_nsec = (ms % 1000) * 1000000;
+        nanosleep(&poll, NULL);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        waited = (now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec);
+        if (ksmmon_read(mon) < 0 || waited / 1000000000L >= timeout) {
+            return -1;
+        }
+    }
+
+    return waited;
+}
@@ -0,0 +1,37 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file ksmmon.h
+ * @brief KSM monitor: poll ksmd's scan progress in /sys/kernel/mm/ksm.
+ * @date 10-17-2026
+ */
+#ifndef _KSMMON_H_
+#define _KSMMON_H_
+
+#define KSM_SYSFS "/sys/kernel/mm/ksm/"
+
+/* Counters read on every poll */
+#define KSM_FULL_SCANS      0
+#define KSM_PAGES_SHARED    1
+#define KSM_PAGES_SHARING   2
+#define KSM_PAGES_TO_SCAN   3
+#define KSM_SLEEP_MILLISECS 4
+#define KSM_RUN             5
+#define KSM_NSTATS          6
+
+#define KSMMON_SCANS      2     /* A page must stay unchanged across two scans to be merged */
+#define KSMMON_POLL_MIN   1     /* Poll interval bounds (ms) */
+#define KSMMON_POLL_MAX   100
+#define KSMMON_TIMEOUT    600   /* Give up on a stalled ksmd (s) */
+
+struct ksmmon {
+    int fd[KSM_NSTATS];           /* Kept open; each poll is one pread per counter */
+    unsigned long stat[KSM_NSTATS];
+};
+
+int ksmmon_open(struct ksmmon *mon);
+void ksmmon_close(struct ksmmon *mon);
+int ksmmon_read(struct ksmmon *mon);
+long ksmmon_wait(struct ksmmon *mon, unsigned long nscans, int timeout);
+
+#endif
@@ -6,16 +6,43 @@
  * @brief Detect memory duplication using KSM in KVM.
  * @date 4-25-2018
  */
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <getopt.h>
+#include <dirent.h>
 
 #include "memdupe.h"
+#include "channel.h"
+#include "timer.h"
+#include "probe.h"
+#include "classify.h"
+#include "bitvec.h"
+#include "fec.h"
+#include "worker.h"
+#include "carrier.h"
+#include "hugepage.h"
+#include "stream.h"
+#include "ksmmon.h"
+#include "ksmemu.h"
+#include "trace.h"
+#include "packet.h"
+#include "arq.h"
+#include "rate.h"
+#include "noise.h"
+
+static int virt_test(void);
+static int cpl_check(void);
+static void free_data(ulong fsize, char** data0, char **data1, char **data2);
+static char *load_carriers(const char *spec, ulong *fsize);
 
 /**
  * cpl_check
@@ -63,260 +90,335 @@ static int virt_test(void) {
 }
 
 /**
- * get_clock_time
- * @brief Get CPU clock time in nanoseconds using clock_gettime.
- * @return CPU clock time in nanoseconds
+ * list_carriers
+ * @brief Expand a carrier spec into paths: a directory gives its non-empty regular files in
+ *        name order, so both sides map them identically; anything else is a comma-separated list.
+ * @param spec FILEPATH argument
+ * @param paths Set to up to MAX_CARRIERS allocated paths
+ * @return Number of paths
  */
-static ulong get_clock_time(void) {
-    struct timespec ts;
-    ulong now = 0;
+static int list_carriers(const char *spec, char **paths) {
+    struct dirent **entries;
+    struct stat st;
+    char full[BUFFER_SIZE];
+    char *copy, *path, *save;
+    int i, nentries, n = 0, skipped = 0;
+
+    if (stat(spec, &st) == 0 && S_ISDIR(st.st_mode)) {
+        nentries = scandir(spec, &entries, NULL, alphasort);
+        for (i = 0; i < nentries; i++) {
+            snprintf(full, sizeof(full), "%s/%s", spec, entries[i]->d_name);
+            if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                if (n < MAX_CARRIERS) {
+                    paths[n++] = strdup(full);
+                } else {
+                    skipped++;
+                }
+            }
+            free(entries[i]);
+        }
+        if (nentries >= 0) {
+            free(entries);
+        }
+        if (skipped > 0) {
+            printf("<memdupe> Warning: using the first %d carriers in '%s', skipped %d\n", MAX_CARRIERS, spec, skipped);
+        }
+        return n;
+    }
 
-    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) >= 0) {
-        now = ts.tv_sec * BILLION + ts.tv_nsec;
+    copy = strdup(spec);
+    for (path = strtok_r(copy, ",", &save); path != NULL && n < MAX_CARRIERS; path = strtok_r(NULL, ",", &save)) {
+        paths[n++] = strdup(path);
     }
+    free(copy);
 
-    return now;
+    return n;
 }
 
 /**
- * load_file
- * @brief Load file into memory
- * @param path Path of file to load
- * @param fsize Pointer to file size
- * @return Pointer to the buffer containing the file
+ * load_carriers
+ * @brief Load every carrier in a spec (see list_carriers) and move them side by side into
+ *        one reserved range with mremap, which keeps each mapping's MADV_MERGEABLE and THP
+ *        flags. The message is then striped across the carriers in order, and the probe,
+ *        worker pool and classifier see one region. Each carrier takes a whole number of
+ *        pages, so a partial last page is probed too.
+ * @param spec FILEPATH argument
+ * @param fsize Pointer to the total size
+ * @return Pointer to the combined carriers, NULL on error
  */
-static char *load_file(const char *path, ulong *fsize) {
-    char *data;
-    int fd;
-    struct stat st;
+static char *load_carriers(const char *spec, ulong *fsize) {
+    char *paths[MAX_CARRIERS];
+    char *parts[MAX_CARRIERS];
+    ulong sizes[MAX_CARRIERS];
+    ulong lens[MAX_CARRIERS];
+    ulong offset, total = 0;
+    char *base = NULL;
+    int i, n;
+
+    n = list_carriers(spec, paths);
+    if (n == 0) {
+        printf("<memdupe> Error: no carriers in '%s'\n", spec);
+        *fsize = 0;
+        return NULL;
+    } else if (n == 1) {
+        base = load_file(paths[0], fsize);
+        free(paths[0]);
+        return base;
+    }
 
-    // Open the file
-    fd = open(path, O_RDONLY);
-    if (fd >= 0) {
-        /* Get file size */
-        fstat(fd, &st);
-        *fsize = st.st_size;
-
-        // Allocate buffer using mmap
-        printf("<memdupe> Reading file: '%s'\n", path);
-        data = (char*) mmap(NULL, *fsize + 1, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0);
-
-        if (data != NULL) {
-            // Read the file
-            read(fd, data, *fsize);
-            data[*fsize] = '\0';  // Terminate string
-            // Indicate that the buffer can be merged by KSM
-            madvise(data, *fsize + 1, MADV_MERGEABLE);
-        } else {
-            printf("<memdupe> Error allocating data: %ld bytes\n", *fsize);
+    for (i = 0; i < n; i++) {
+        parts[i] = load_file(paths[i], &sizes[i]);
+        lens[i] = (sizes[i] + MY_PAGE_SIZE - 1) / MY_PAGE_SIZE * MY_PAGE_SIZE;
+        total += lens[i];
+        free(paths[i]);
+    }
+
+    /* Reserve one range, then move each carrier into its slice of it */
+    base = (char *) mmap(NULL, total, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    base = (base != MAP_FAILED) ? base : NULL;
+
+    offset = 0;
+    for (i = 0; i < n; i++) {
+        if (parts[i] == NULL || base == NULL ||
+            mremap(parts[i], lens[i], lens[i], MREMAP_MAYMOVE | MREMAP_FIXED, base + offset) == MAP_FAILED) {
+            printf("<memdupe> Error mapping carrier %d of %d\n", i + 1, n);
+            for (; i < n; i++) {
+                if (parts[i] != NULL) {
+                    munmap(parts[i], lens[i]);
+                }
+            }
+            if (base != NULL) {
+                munmap(base, total);
+            }
             *fsize = 0;
+            return NULL;
         }
-
-        // Close file
-        close(fd);
-    } else {
-        printf("<memdupe> Error opening file: '%s'\n", path);
-        *fsize = 0;
+        offset += lens[i];
     }
 
-    return data;
+    printf("<memdupe> Mapped %d carriers side by side: %ld pages\n", n, total / MY_PAGE_SIZE);
+    *fsize = total;
+
+    return base;
 }
 
 /**
- * write_pages
- * @param data Pointer to the file data in memory
- * @param pages Number of pages occupied by the file
- * @param step Step indicates whether first write or second
- * @return Clock time required to write pages (ns)
+ * free_data
+ * @brief Free data allocated during execution
+ * @param fsize File size loaded in each file
+ * @param data0 First data pointer
+ * @param data1 Second data pointer
+ * @param data2 Third data pointer
  */
-static ulong write_pages(char** data, ulong pages, uint step) {
-    char byte;
-    char *bits = NULL;
-    char *msg = NULL;
-    uint dowrite = 0;
-    uint islong = 0;
-    ulong nbits = 0;
-    ulong index = 0;
-    ulong tinit = 0;
-    ulong time1 = 0;
-    ulong time2 = 0;
-    ulong tend = 0;
-    ulong tdiff = 0;
-    ulong tsum = 0;
-    ulong tmean = 0;
-
-    if (_vmrole == SENDER) {
-        /* Encode the message bytes => bits if the Sender */
-        bits = encode_message(_message, &nbits);
-        if (nbits > pages) {
-            nbits = pages;
-        }
-    } else {
-        /* Write every page if not the Sender */
-        nbits = pages;
-        bits = (char *) malloc(nbits);
-        memset(bits, 1, nbits);
+static void free_data(ulong fsize, char** data0, char **data1, char **data2) {
+    munmap(*data0, fsize);
+    if (*data1 != NULL) {
+        munmap(*data1, fsize);
     }
-
-    /* Start timer for writing pages... */
-    tinit = get_clock_time();
-
-    if (DEBUG && step == 1) {
-        fprintf(stderr, "Op,Page,Time,Long?\n");
+    if (*data2 != NULL) {
+        munmap(*data2, fsize);
     }
+}
 
-    do {
-        time1 = get_clock_time();
-
-        /* Write to 1 bits */
-        dowrite = (nbits > index && bits[index]);
-        if (dowrite) {
-            (*data)[pages * MY_PAGE_SIZE - 1] = '.';
-        }
-
-        // Calculate time to write page
-        time2 = get_clock_time();
-        tdiff = time2 - time1;
-
-        // Calculate the running mean and determine if it exceeds the KSM threshold
-        tsum += tdiff;
-        tmean = tsum / (index + 1);
-        islong = (tdiff > _ksmthresh * tmean);
-
-        if (dowrite && _vmrole == SENDER && DEBUG) {
-            fprintf(stderr, "W,%ld,%ld,%d\n", index, tdiff, islong);
-        } else if (step > 1) {
-            if (DEBUG) fprintf(stderr, "R,%ld,%ld,%d\n", index, tdiff, islong);
-            // If write time is long, COW means page has been deduplicated by receier
-            bits[index] = !islong;
-        } else if (DEBUG) {
-            fprintf(stderr, "T,%ld,%ld\n", index, tdiff);
-        }
-
-        index++;
-        pages--;
-    } while (pages > 0);
-
-    /* Stop timer */
-    tend = get_clock_time();
-    tdiff = tend - tinit;
-
-    /* Decode the message if Receiver */
-    if (step > 1 && _vmrole == RECEIVER) {
-        msg = decode_message(bits, index);
-        free(msg);
-    }
+/**
+ * fec_pages
+ * @param mode FEC mode
+ * @param nbytes Bytes to carry
+ * @return Smallest whole number of STREAM_ALIGN pages that carries nbytes after FEC
+ */
+static ulong fec_pages(int mode, ulong nbytes) {
+    ulong pages;
 
-    // Free memory...
-    if (nbits > 0) {
-        free(bits);
-    }
+    for (pages = STREAM_ALIGN; fec_capacity(mode, pages) / BYTEBITS < nbytes; pages += STREAM_ALIGN);
 
-    return tdiff;
+    return pages;
 }
 
 /**
- * encode_message
- * @brief Encode message before sending through covert channel (bytes => bits)
- * @param msg The message to be encoded (bytes)
- * @param nbits Pointer to the number of bits in the encoded message
- * @return Pointer to the encoded buffer (bits)
+ * memdupe_stream
+ * @brief Stream the message continuously through rotating frames of the carrier. Each
+ *        epoch the Sender re-keys one frame and writes the next packets of the message into
+ *        it, while the Receiver probes the frame written nframes - 1 epochs earlier and keys
+ *        the one just written, so ksmd always has frames to scan and the bit rate is bounded
+ *        by its scan rate. With ACKs on, a second, smaller ring of frames at the end of the
+ *        carrier runs the other way, half an epoch out of step: the Receiver writes an ACK
+ *        into it after each probe, and the Sender reads it back before each write. When
+ *        adapting, the Receiver's rate controller sets how long frames wait before they are
+ *        probed, and the ACK carries its page budget back to the Sender.
+ * @param ch Channel
+ * @param data Pointer to the carrier
+ * @param pages Number of pages in the carrier
  */
-static char *encode_message(char *msg, ulong *nbits) {
-    char buff[BYTEBITS];
-    char *bits;
-    int i, j;
-    uint index;
-    uint nchars;
-
-    nchars = strlen(msg);
-    *nbits = nchars * BYTEBITS;
-
-    bits = (char*) malloc(*nbits);
-
-    index = 0;
-    for (i = 0; i < nchars; i++) {
-        for (j = 0; j < BYTEBITS; j++) {
-            buff[j] = (msg[i] & (BITMASK << j)) != 0;
+static void memdupe_stream(struct memdupe_channel *ch, char *data, ulong pages) {
+    const struct memdupe_config *cfg = ch->cfg;
+    char *frame;
+    uint64_t seed = 0;
+    ulong npages;
+    ulong chunk;
+    ulong seq;
+    ulong ackpages = 0;
+    ulong minpages;
+    ulong received = 0;
+    ulong payloadbits;
+    ulong wtime;
+    long epoch, first, last, next, lag, done = 0;
+    long nframes = cfg->nframes;
+
+    carrier_parse(cfg->filepath, &seed, &npages);
+
+    /* Reverse channel: the smallest frames that hold one ACK packet, keyed apart from the forward frames */
+    if (cfg->ack) {
+        ackpages = fec_pages(cfg->fecmode, PACKET_OVERHEAD + ARQ_ACK_BYTES + (cfg->adapt ? RATE_ACK_BYTES : 0)) * nframes;
+        if (ackpages >= pages || stream_init(&ch->ackstream, data + (pages - ackpages) * MY_PAGE_SIZE, ackpages,
+                                             MY_PAGE_SIZE, nframes, cfg->sleeptime, seed ^ ARQ_KEY) < 0) {
+            printf("<memdupe> Error: no room for %ld ACK pages in %ld pages\n", ackpages, pages);
+            return;
         }
+        pages -= ackpages;
+    }
 
-        for (j = BYTEBITS - 1; j >= 0; j--) {
-            bits[index++] = buff[j];
-        }
+    if (stream_init(&ch->stream, data, pages, MY_PAGE_SIZE, nframes, cfg->sleeptime, seed) < 0) {
+        printf("<memdupe> Error: cannot split %ld pages into %ld frames of %d s\n", pages, nframes, cfg->sleeptime);
+        return;
     }
 
-    printf("<memdupe> Encoded message: '%s' => ", msg);
-    for (i = 0; i < *nbits; i++) {
-        printf("%d", bits[i]);
-        if (i % 8 == 7) {
-            printf(" ");
-        }
+    /* Every frame must carry at least one whole packet, or nothing is ever framed */
+    minpages = fec_pages(cfg->fecmode, PACKET_OVERHEAD + PACKET_PAYLOAD);
+    if (ch->stream.framepages < minpages) {
+        printf("<memdupe> Error: frames of %ld pages cannot hold a packet, which needs %ld pages\n",
+               ch->stream.framepages, minpages);
+        return;
     }
-    printf("\n");
 
-    return bits;
-}
+    chunk = fec_capacity(cfg->fecmode, ch->stream.framepages) / BYTEBITS;
+    printf("<memdupe> Streaming %ld frames of %ld pages, %d s per epoch, %ld packet bytes per frame\n",
+           ch->stream.nframes, ch->stream.framepages, ch->stream.period, chunk);
+
+    /* The Receiver's first frame is the one the Sender writes in the first epoch */
+    first = stream_epoch(&ch->stream) + 1;
+    last = first + cfg->rounds + ((cfg->role == RECEIVER) ? nframes - 1 : 0);
+    next = first;
+
+    /* Both sides start from the same budget; only the ACK can tell the Sender it changed */
+    if (cfg->adapt) {
+        rate_init(&ch->rate, cfg->fecmode, (cfg->ack) ? minpages : ch->stream.framepages, ch->stream.framepages,
+                  nframes - 1);
+        if (!cfg->ack) {
+            printf("<memdupe> Warning: the page budget needs ACKs, adapting the probe lag only\n");
+        }
+    }
 
-/**
- * decode_message
- * @brief Decode message received through covert channel (bits => bytes)
- * @param bits Pointer to array of bits from writing pages
- * @param nbits Number of bits in the message
- * @return Pointer to the decoded message
- */
-static char *decode_message(char *bits, ulong nbits) {
-    char bit;
-    char val = '\0';
-    char *msg = NULL;
-    int i, j;
-    uint index;
-    uint nchars;
-
-    nchars = nbits / BYTEBITS;
-    msg = (char *) malloc(nchars + 1);
-
-    index = 0;
-    for (i = 0; i < nbits; i += BYTEBITS) {
-        val = 0;
-        for (j = 0; j < BYTEBITS; j++) {
-            bit = bits[i + j] ? 1 : 0;
-            val *= 2;
-            val += bit;
+    /* A packet's ACK is read back 2 * nframes - 1 epochs after it is sent */
+    if (cfg->ack && cfg->role == SENDER) {
+        if (arq_init(&ch->arq, packet_count(cfg->msglen), 2 * nframes - 1) < 0) {
+            printf("<memdupe> Error allocating ACK state\n");
+            return;
         }
-        msg[index] = val;
-        index += 1;
+        printf("<memdupe> Selective repeat over %ld ACK frames of %ld pages\n",
+               ch->ackstream.nframes, ch->ackstream.framepages);
     }
 
-    msg[index] = '\0';
-    printf("<memdupe> Decoded message: '%s'\n", msg);
+    for (epoch = first; cfg->rounds == 0 || epoch < last; epoch++) {
+        ch->epoch = epoch;
+        if (cfg->role == SENDER) {
+            stream_wait(&ch->stream, epoch, 0);
 
-    return msg;
-}
+            /* Read the ACK written nframes epochs ago, then key the one written last epoch */
+            if (cfg->ack) {
+                if (epoch - first >= 2 * nframes - 1) {
+                    frame = stream_frame(&ch->ackstream, epoch);
+                    write_pages(ch, &frame, ch->ackstream.framepages, 2);
+                }
+                if (epoch - first >= nframes) {
+                    stream_rekey(&ch->ackstream, epoch - 1);
+                }
 
-/**
- * free_data
- * @brief Free data allocated during execution
- * @param fsize File size loaded in each file
- * @param data0 First data pointer
- * @param data1 Second data pointer
- * @param data2 Third data pointer
- */
-static void free_data(ulong fsize, char** data0, char **data1, char **data2) {
-    munmap(data0, fsize + 1);
-    if (data1 != NULL) {
-        munmap(data1, fsize + 1);
+                if (ch->arq.nacked == ch->arq.count) {
+                    printf("<memdupe> All %ld packets acknowledged after %ld epochs, %ld retransmitted\n",
+                           ch->arq.count, epoch - first, ch->arq.resent);
+                    break;
+                }
+            }
+
+            /* Start of the epoch: re-key this epoch's frame and write the next packets */
+            seq = ch->seq;
+            stream_rekey(&ch->stream, epoch);
+            frame = stream_frame(&ch->stream, epoch);
+            wtime = write_pages(ch, &frame, ch->stream.framepages, 1);
+            if (cfg->ack) {
+                printf("<memdupe> Epoch %ld: wrote frame %ld (%ld packets, %ld retransmitted) in %ld ns\n",
+                       epoch, epoch % nframes, ch->arq.lastsent, ch->arq.lastresent, wtime);
+            } else {
+                printf("<memdupe> Epoch %ld: wrote frame %ld (packets %ld-%ld) in %ld ns\n",
+                       epoch, epoch % nframes, seq, ch->seq - 1, wtime);
+            }
+
+            /* Repeat the message from the start once every packet has gone out */
+            if (ch->seq >= packet_count(cfg->msglen)) {
+                ch->seq = 0;
+            }
+        } else {
+            /* Mid-epoch, so clock skew between the sides cannot reorder writes and probes */
+            stream_wait(&ch->stream, epoch, BILLION / 2 * ch->stream.period);
+
+            /* Probe each frame that has waited out the lag, oldest first (none or two as it changes) */
+            lag = (cfg->adapt) ? ch->rate.lag : nframes - 1;
+            for (; next <= epoch - lag && (cfg->rounds == 0 || next < first + (long) cfg->rounds); next++) {
+                frame = stream_frame(&ch->stream, next);
+                wtime = write_pages(ch, &frame, ch->stream.framepages, 2);
+
+                /* Only payload that passed its CRC counts toward the sustained rate */
+                received++;
+                payloadbits = ch->rx.payload * BYTEBITS;
+                printf("<memdupe> Epoch %ld: probed frame %ld in %ld ns, %ld frames, %ld payload bits, "
+                       "%ld uncorrectable codewords, sustained %.2f bits/s\n",
+                       epoch, next % nframes, wtime, received, payloadbits, ch->fecstats.failed,
+                       (double) payloadbits / (received * ch->stream.period));
+                lag = (cfg->adapt) ? ch->rate.lag : nframes - 1;
+            }
+
+            /* Key the frame the Sender wrote at the start of this epoch, now its bits are in */
+            stream_rekey(&ch->stream, epoch);
+            if (received == 0) {
+                continue;
+            }
+
+            /* Answer in this epoch's ACK frame */
+            if (cfg->ack) {
+                stream_rekey(&ch->ackstream, epoch);
+                frame = stream_frame(&ch->ackstream, epoch);
+                write_pages(ch, &frame, ch->ackstream.framepages, 1);
+            }
+
+            if (cfg->rounds > 0 && next >= first + (long) cfg->rounds) {
+                break;
+            }
+
+            /* Once the message is whole, keep acknowledging for a round trip, then stop */
+            if (cfg->ack && ch->rx.count > 0 && ch->rx.nhave == ch->rx.count) {
+                done = (done > 0) ? done : epoch;
+                if (epoch - done >= 2 * nframes) {
+                    printf("<memdupe> All %ld packets received\n", ch->rx.count);
+                    break;
+                }
+            }
+        }
     }
-    if (data2 != NULL) {
-        munmap(data2, fsize + 1);
+
+    /* Keep the Sender's frames mapped until the Receiver has probed the last one */
+    if (cfg->role == SENDER && cfg->rounds > 0 && epoch >= last) {
+        stream_wait(&ch->stream, last + cfg->nframes - 1, 0);
     }
 }
 
 /**
  * memdupe_init
- * @brief Setup and run
+ * @brief Setup and run one channel
+ * @param cfg Channel configuration
  * @return Virtualization status
  */
-static int memdupe_init(void) {
+static int memdupe_init(const struct memdupe_config *cfg) {
+    struct memdupe_channel *ch;
     char *data0, *data1 = NULL, *data2 = NULL;
 
     uint vmx_on = FALSE;
@@ -325,9 +427,13 @@ static int memdupe_init(void) {
     uint nbits;
 
     ulong fsize;
+    ulong fsize1 = 0;
+    ulong fsize2 = 0;
     ulong pages;
     ulong wtime = 0;
     ulong w2time = 0;
+    ulong tstart = 0;
+    ulong tround = 0;
 
     float ratio = 0.0;
 
@@ -342,58 +448,144 @@ static int memdupe_init(void) {
     /* Get CPL flag */
     cpl_flag = cpl_check();
 
+    ch = (struct memdupe_channel *) calloc(1, sizeof(struct memdupe_channel));
+    if (ch == NULL) {
+        return vm_stat;
+    }
+    ch->cfg = cfg;
+
     if (cpl_flag == CPL_USER) {
         /* 1) Load a file (same data into memory) -- Sender / Receiver */
-        data0 = load_file(_filepath, &fsize);
+        data0 = load_carriers(cfg->filepath, &fsize);
+
+        /* Move the carrier into the KSM emulator's shared regions */
+        if (data0 != NULL && cfg->ksmpenalty > 0 && ksmemu_init(&ch->ksmemu, cfg->ksmpenalty, MY_PAGE_SIZE) == 0) {
+            printf("<memdupe> Emulating KSM: %ld ns per broken merge, scan every %d ms\n",
+                   cfg->ksmpenalty, KSMEMU_SCAN_MS);
+            data0 = ksmemu_adopt(&ch->ksmemu, data0, fsize);
+        }
 
         if (fsize > 0 && data0 != NULL) {
             pages = fsize / MY_PAGE_SIZE;
             printf("<memdupe> Read file of size %ld B, %ld pages\n", fsize, pages);
+            printf("<memdupe> Carrier mapped at %p in pid %d\n", (void *) data0, (int) getpid());
+
+            /* Preallocate the per-page timing array */
+            if (probe_init(&ch->probe, pages, MY_PAGE_SIZE) < 0) {
+                printf("<memdupe> Error allocating probe array: %ld pages\n", pages);
+                ksmemu_free(&ch->ksmemu);
+                free_data(fsize, &data0, &data1, &data2);
+                free(ch);
+                return vm_stat;
+            }
 
-            /* Load file 2 more times */
-            if (_readtwice) {
-                data1 = load_file(_filepath, &fsize);
-                data2 = load_file(_filepath, &fsize);
+            /* Histograms always, the per-page ring only when it will be written out */
+            if (trace_init(&ch->trace, (cfg->tracepath != NULL) ? TRACE_RECORDS : 0) < 0) {
+                printf("<memdupe> Warning: could not allocate trace ring, keeping histograms only\n");
+            }
+
+            /* Start the pinned worker pool for parallel stripes */
+            if (cfg->nworkers != 1 && worker_init(&ch->pool, cfg->nworkers) == 0) {
+                printf("<memdupe> Probing with %d pinned workers\n", ch->pool.nworkers);
+            }
+
+            /* Calibrate the noise floor on private pages before anything is probed */
+            if (cfg->noise && ch->pool.workers != NULL) {
+                printf("<memdupe> Warning: noise filtering needs a single probe thread, disabled\n");
+            } else if (cfg->noise && noise_init(&ch->noise, MY_PAGE_SIZE, pages) == 0) {
+                noise_calibrate(&ch->noise);
+                printf("<memdupe> Noise floor: %ld ns, sigma %ld ns over %d private pages%s%s\n",
+                       timer_to_ns(ch->noise.floor), timer_to_ns(ch->noise.sigma), NOISE_PAGES,
+                       (ch->noise.irqfd < 0) ? ", no interrupt counts" : "",
+                       (ch->noise.schedfd < 0) ? ", no migration counts" : "");
+            } else if (cfg->noise) {
+                printf("<memdupe> Warning: could not map noise calibration pages\n");
             }
 
-            /* 2) Write pages once... -- Sender encodes message */
-            if (_vmrole != RECEIVER) {
-                wtime = write_pages(&data0, pages, 1);
-                printf("<memdupe> Wrote %ld pages once in %ld ns\n", pages, wtime);
+            /* Load file 2 more times */
+            if (cfg->readtwice) {
+                data1 = load_carriers(cfg->filepath, &fsize1);
+                data2 = load_carriers(cfg->filepath, &fsize2);
+                if (ch->ksmemu.arena != NULL) {
+                    data1 = ksmemu_adopt(&ch->ksmemu, data1, fsize1);
+                    data2 = ksmemu_adopt(&ch->ksmemu, data2, fsize2);
+                }
             }
 
-            /* 3) Sleep and wait for KSM to work -- Sender / Receiver*/
-            printf("<memdupe> Sleep for %d seconds\n", _sleeptime);
-            sleep(_sleeptime);
+            /* Stream through rotating frames instead of a single round */
+            if (cfg->nframes > 0 && cfg->role != TESTER) {
+                memdupe_stream(ch, data0, pages);
+            } else {
+                tstart = timer_clock(CLOCK_MONOTONIC_RAW);
 
-            /* 4) Write pages again and detect the ones that take longer to write -- Receiver... */
-            if (_vmrole != SENDER) {
-                w2time = write_pages(&data0, pages, 2);
-                printf("<memdupe> Wrote %ld pages again in %ld ns\n", pages, w2time);
+                /* 2) Write pages once... -- Sender encodes message */
+                if (cfg->role != RECEIVER) {
+                    wtime = write_pages(ch, &data0, pages, 1);
+                    printf("<memdupe> Wrote %ld pages once in %ld ns\n", pages, wtime);
+                }
 
-                if (_vmrole == TESTER) {
-                    ratio = (float) w2time / (float) wtime;
-                    vm_stat = (ratio > (float) _ksmthresh) ? TRUE : FALSE;
+                /* 3) Wait for KSM to work -- Sender / Receiver*/
+                ksm_wait(ch);
+
+                /* 4) Write pages again and detect the ones that take longer to write -- Receiver... */
+                if (cfg->role != SENDER) {
+                    w2time = write_pages(ch, &data0, pages, 2);
+                    printf("<memdupe> Wrote %ld pages again in %ld ns\n", pages, w2time);
+
+                    if (cfg->role == RECEIVER) {
+                        tround = timer_clock(CLOCK_MONOTONIC_RAW) - tstart;
+                        printf("<memdupe> FEC %s: %ld data bits in %ld channel bits, corrected %ld errors, "
+                               "%ld uncorrectable codewords, goodput %.2f bits/s\n",
+                               fec_name(cfg->fecmode), ch->fecstats.databits, ch->fecstats.codebits,
+                               ch->fecstats.corrected, ch->fecstats.failed,
+                               (double) ch->fecstats.databits * BILLION / tround);
+                    }
+
+                    if (cfg->role == TESTER) {
+                        ratio = (float) w2time / (float) wtime;
+                        vm_stat = (ratio > (float) cfg->ksmthresh) ? TRUE : FALSE;
+
+                        printf("<memdupe> Ratio = %g = %ld / %ld, Threshold = %d, VM_Status = %d\n",
+                               ratio, w2time, wtime, cfg->ksmthresh, vm_stat);
+                    }
+                }
 
-                    printf("<memdupe> Ratio = %g = %ld / %ld, Threshold = %d, VM_Status = %d\n",
-                           ratio, w2time, wtime, _ksmthresh, vm_stat);
+                if (cfg->role == TESTER) {
+                    if (vm_stat) {
+                        printf("<memdupe> Memory deduplication probably occurred\n");
+                    } else {
+                        printf("<memdupe> Memory deduplication did not occur\n");
+                    }
                 }
             }
 
-            if (_vmrole == TESTER) {
-                if (vm_stat) {
-                    printf("<memdupe> Memory deduplication probably occurred\n");
-                } else {
-                    printf("<memdupe> Memory deduplication did not occur\n");
-                }
+            /* Latency summary and trace export, after all timing is done */
+            trace_report(&ch->trace);
+            if (cfg->tracepath != NULL && trace_dump(&ch->trace, cfg->tracepath) >= 0) {
+                printf("<memdupe> Wrote trace to '%s'\n", cfg->tracepath);
             }
+            trace_free(&ch->trace);
+
+            /* Report the huge page state actually obtained */
+            hugepage_report("carrier", data0);
+            hugepage_report("timing", ch->probe.ticks);
 
             // Avoid memory leaks...
+            worker_free(&ch->pool);
+            probe_free(&ch->probe);
+            if (ch->noise.region != NULL) {
+                noise_free(&ch->noise);
+            }
+            ksmemu_free(&ch->ksmemu);
+            packet_rx_free(&ch->rx);
+            packet_rx_free(&ch->ackrx);
+            arq_free(&ch->arq);
             free_data(fsize, &data0, &data1, &data2);
             printf("<memdupe> Freed data pointers\n");
         }
     }
 
+    free(ch);
     return vm_stat;
 }
 
@@ -405,62 +597,277 @@ static void memdupe_exit(void) {
     printf("<memdupe> Done\n");
 }
 
+/* Long options; the positional form takes the same options in this order */
+static const struct option _options[] = {
+    {"role",         required_argument, NULL, 'r'},
+    {"sleep",        required_argument, NULL, 's'},
+    {"file",         required_argument, NULL, 'f'},
+    {"threshold",    required_argument, NULL, 'k'},
+    {"message",      required_argument, NULL, 'm'},
+    {"read-twice",   required_argument, NULL, 'R'},
+    {"timer",        required_argument, NULL, 't'},
+    {"classifier",   required_argument, NULL, 'c'},
+    {"fec",          required_argument, NULL, 'e'},
+    {"threads",      required_argument, NULL, 'j'},
+    {"hugepages",    required_argument, NULL, 'H'},
+    {"frames",       required_argument, NULL, 'F'},
+    {"rounds",       required_argument, NULL, 'n'},
+    {"ksmemu",       required_argument, NULL, 'E'},
+    {"trace",        required_argument, NULL, 'T'},
+    {"ack",          required_argument, NULL, 'a'},
+    {"adapt",        required_argument, NULL, 'A'},
+    {"noise",        required_argument, NULL, 'N'},
+    {"message-file", required_argument, NULL, 'M'},
+    {"help",         no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+#define POSITIONAL "rsfkmRtcejHFnETaAN"
+
 /**
- * Main function
- * @param argc Arg count
- * @param argv Arguments
- * @return Exit status
+ * role_name
+ * @param role VM role
+ * @return Role name
  */
-int main(int argc, char **argv) {
-    uint status;
+static const char *role_name(int role) {
+    switch (role) {
+        case TESTER:   return "tester";
+        case SENDER:   return "sender";
+        case RECEIVER: return "receiver";
+        default:       return "unknown";
+    }
+}
 
-    if (argc > 6) {
-        _readtwice = atoi(argv[6]);
-    } else {
-        _readtwice = TRUE;
+/**
+ * parse_name
+ * @brief Accept either a number or one of the names a *_name function returns.
+ * @param arg Argument
+ * @param name Name function
+ * @param first First valid value
+ * @param last Last valid value
+ * @param value Set to the matching value
+ * @return 0 on success, -1 if the argument is neither a known name nor a valid number
+ */
+static int parse_name(const char *arg, const char *(*name)(int), int first, int last, int *value) {
+    char *end;
+    long num;
+    int i;
+
+    for (i = first; i <= last; i++) {
+        if (strcmp(arg, name(i)) == 0) {
+            *value = i;
+            return 0;
+        }
     }
 
-    if (argc > 5) {
-        strcpy(_message, argv[5]);
-    } else {
-        strcpy(_message, MESSAGE);
+    num = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || num < first || num > last) {
+        printf("<memdupe> Error: unknown value '%s', expected %s to %s or %d to %d\n",
+               arg, name(first), name(last), first, last);
+        return -1;
     }
 
-    if (argc > 4) {
-        _ksmthresh = atoi(argv[4]);
-    } else {
-        _ksmthresh = KSM_THRESHOLD;
+    *value = (int) num;
+    return 0;
+}
+
+/**
+ * read_message
+ * @brief Read a whole message file, or stdin for "-", so payloads are not limited by argv.
+ * @param path Path of the message file
+ * @param len Set to the message length
+ * @return NUL-terminated copy of the message, NULL on error
+ */
+static char *read_message(const char *path, ulong *len) {
+    char *msg = NULL, *grown;
+    ulong size = BUFFER_SIZE;
+    ssize_t nread;
+    int fd;
+
+    fd = (strcmp(path, "-") == 0) ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0 || (msg = (char *) malloc(size + 1)) == NULL) {
+        printf("<memdupe> Error reading message file: '%s'\n", path);
+        return NULL;
     }
 
-    if (argc > 3) {
-        strcpy(_filepath, argv[3]);
-    } else {
-        strcpy(_filepath, FILEPATH);
+    *len = 0;
+    while ((nread = read(fd, msg + *len, size - *len)) != 0) {
+        if (nread < 0 && errno == EINTR) {
+            continue;
+        } else if (nread < 0) {
+            printf("<memdupe> Error reading message file: '%s'\n", path);
+            free(msg);
+            msg = NULL;
+            break;
+        }
+
+        *len += nread;
+        if (*len == size) {
+            size *= 2;
+            grown = (char *) realloc(msg, size + 1);
+            if (grown == NULL) {
+                free(msg);
+                msg = NULL;
+                break;
+            }
+            msg = grown;
+        }
     }
 
-    if (argc > 2) {
-        _sleeptime = atoi(argv[2]);
-    } else {
-        _sleeptime = NUM_SECONDS;
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    if (msg != NULL) {
+        msg[*len] = '\0';
     }
 
-    if (argc > 1) {
-        if (strstr(argv[1], "-h")) {
-            printf("usage: memdupe ROLE[0=TESTER|1=SENDER|2=RECEIVER] SLEEPTIME=5 FILEPATH=/usr/bin/vim.tiny KSM_THRESHOLD=3 MESSAGE=\"Hello!\"\n");
-            _vmrole = -1;
-        } else {
-            _vmrole = atoi(argv[1]);
+    return msg;
+}
+
+/**
+ * set_option
+ * @brief Apply one option, given either as a flag or by position.
+ * @param cfg Configuration
+ * @param opt Short option
+ * @param arg Option argument
+ * @return 0 on success, -1 on error
+ */
+static int set_option(struct memdupe_config *cfg, int opt, const char *arg) {
+    switch (opt) {
+        case 'r': return parse_name(arg, role_name, TESTER, RECEIVER, &cfg->role);
+        case 's': cfg->sleeptime = atoi(arg); break;
+        case 'f': cfg->filepath = arg; break;
+        case 'k': cfg->ksmthresh = atoi(arg); break;
+        case 'R': cfg->readtwice = atoi(arg); break;
+        case 't': return parse_name(arg, timer_name, TIMER_AUTO, TIMER_MONORAW, &cfg->timer);
+        case 'c': return parse_name(arg, classify_name, CLASS_MEAN, CLASS_OTSU, &cfg->classifier);
+        case 'e': return parse_name(arg, fec_name, FEC_NONE, FEC_RS, &cfg->fecmode);
+        case 'j': cfg->nworkers = atoi(arg); break;
+        case 'H': cfg->hugepolicy = atoi(arg); break;
+        case 'F': cfg->nframes = atol(arg); break;
+        case 'n': cfg->rounds = atol(arg); break;
+        case 'E': cfg->ksmpenalty = atol(arg); break;
+        case 'T': cfg->tracepath = arg; break;
+        case 'a': cfg->ack = atoi(arg); break;
+        case 'A': cfg->adapt = atoi(arg); break;
+        case 'N': cfg->noise = atoi(arg); break;
+        case 'm':
+        case 'M':
+            free(cfg->message);
+            if (opt == 'M') {
+                cfg->message = read_message(arg, &cfg->msglen);
+            } else {
+                cfg->message = strdup(arg);
+                cfg->msglen = strlen(arg);
+            }
+            return (cfg->message != NULL) ? 0 : -1;
+        default:
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * usage
+ * @brief Print the options.
+ */
+static void usage(void) {
+    printf("usage: memdupe [OPTIONS] [ROLE SLEEPTIME FILEPATH KSM_THRESHOLD MESSAGE READTWICE TIMER CLASSIFIER FEC THREADS "
+           "HUGEPAGES FRAMES ROUNDS KSMEMU TRACE ACK ADAPT NOISE]\n"
+           "  -r, --role ROLE           tester|sender|receiver (0|1|2), default tester\n"
+           "  -s, --sleep SECONDS       Fixed wait without KSM, or epoch length when streaming, default %d\n"
+           "  -f, --file PATH           Carrier file, synth:SEED[:PAGES], a comma list or a directory, default %s\n"
+           "  -k, --threshold K         Tester slow-down ratio and classifier gap, default %d\n"
+           "  -m, --message TEXT        Message to send, default \"%s\"\n"
+           "  -M, --message-file PATH   Read the message from a file, or stdin for -\n"
+           "  -R, --read-twice 0|1      Load the carrier 2 more times, default 1\n"
+           "  -t, --timer NAME          auto|cputime|tsc|monoraw, default auto\n"
+           "  -c, --classifier NAME     mean|mad|otsu, default otsu\n"
+           "  -e, --fec NAME            none|hamming|rs, default none\n"
+           "  -j, --threads N           Probe workers, 0 for one per CPU, default 1\n"
+           "  -H, --hugepages N         0=off 1=no THP carrier 2=huge buffers 3=both, default 3\n"
+           "  -F, --frames N            Stream through N frames, 0 for one shot, default 0\n"
+           "  -n, --rounds N            Frames to stream, 0 for no limit, default 0\n"
+           "  -E, --ksmemu NS           Emulate KSM with this COW penalty, 0 for real KSM, default 0\n"
+           "  -T, --trace PATH          Write the per-page trace (.csv or binary)\n"
+           "  -a, --ack 0|1             Reverse ACK channel with selective repeat when streaming, default 0\n"
+           "  -A, --adapt 0|1           Adapt the probe lag and page budget to errors when streaming, default 0\n"
+           "  -N, --noise 0|1           Calibrate the noise floor and filter disturbed probes, default 0\n"
+           "  -h, --help                Show this help\n",
+           NUM_SECONDS, FILEPATH, KSM_THRESHOLD, MESSAGE);
+}
+
+/**
+ * parse_args
+ * @brief Fill in the configuration from options, then from any positional arguments.
+ *        Options must come first, so negative positional values are not taken for flags.
+ * @param argc Arg count
+ * @param argv Arguments
+ * @param cfg Configuration to fill in
+ * @return 0 to run, -1 to exit
+ */
+static int parse_args(int argc, char **argv, struct memdupe_config *cfg) {
+    int opt, i;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->role = TESTER;
+    cfg->sleeptime = NUM_SECONDS;
+    cfg->filepath = FILEPATH;
+    cfg->ksmthresh = KSM_THRESHOLD;
+    cfg->readtwice = TRUE;
+    cfg->timer = TIMER_AUTO;
+    cfg->classifier = CLASS_OTSU;
+    cfg->fecmode = FEC_NONE;
+    cfg->nworkers = 1;
+    cfg->hugepolicy = HUGE_DEFAULT;
+    set_option(cfg, 'm', MESSAGE);
+
+    while ((opt = getopt_long(argc, argv, "+r:s:f:k:m:R:t:c:e:j:H:F:n:E:T:a:A:N:M:h", _options, NULL)) != -1) {
+        if (opt == 'h' || opt == '?' || set_option(cfg, opt, optarg) < 0) {
+            usage();
+            return -1;
         }
-    } else {
-        _vmrole = 0;
     }
 
-    if (_vmrole >= 0) {
-        // Check this file:
-        // /sys/kernel/mm/ksm/pages_shared
-        status = memdupe_init();
+    for (i = 0; optind + i < argc; i++) {
+        if (i >= (int) strlen(POSITIONAL) || set_option(cfg, POSITIONAL[i], argv[optind + i]) < 0) {
+            usage();
+            return -1;
+        }
+    }
+
+    /* Sequence numbers and packet counts are 16 bits on the wire */
+    if (cfg->msglen > (ulong) PACKET_MAX * PACKET_PAYLOAD) {
+        printf("<memdupe> Error: message of %ld bytes needs more than %d packets of %d bytes\n",
+               cfg->msglen, PACKET_MAX, PACKET_PAYLOAD);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Main function
+ * @param argc Arg count
+ * @param argv Arguments
+ * @return Exit status
+ */
+int main(int argc, char **argv) {
+    struct memdupe_config cfg;
+    uint status = 0;
+    int timer;
+
+    if (parse_args(argc, argv, &cfg) == 0) {
+        hugepage_init(cfg.hugepolicy);
+
+        timer = timer_init(cfg.timer);
+        printf("<memdupe> Timer: %s, %g ns/tick, overhead %ld ticks\n",
+               timer_name(timer), timer_ns_per_tick(), timer_overhead());
+
+        status = memdupe_init(&cfg);
         memdupe_exit();
     }
 
+    free(cfg.message);
     return status;
 }
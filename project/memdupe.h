@@ -13,7 +13,7 @@
 #define FALSE 0
 #endif
 
-#define DEBUG        1
+#define VERBOSE      0
 #define BILLION      1000000000
 #define BUFFER_SIZE  4096
 #define MY_PAGE_SIZE 4096
@@ -21,6 +21,7 @@
 #define CPUID_VMX_BIT 5
 #define FEATURE_CONTROL_MSR 0x3A
 #define FILEPATH "/usr/bin/vim.tiny"
+#define MAX_CARRIERS 64
 
 #define NUM_READS     2
 #define NUM_SECONDS   5
@@ -42,21 +43,46 @@
 typedef unsigned int  uint;
 typedef unsigned long ulong;
 
-static char _filepath[1024];
-static char _message[1024];
+#ifdef __KERNEL__
+struct classify;
+struct ksmwalk;
+struct kmemdupe_config;
 
-static int _vmrole;
-static int _sleeptime;
-static int _ksmthresh;
-static int _readtwice;
-
-static int virt_test(void);
-static int cpl_check(void);
-static ulong get_clock_time(void);
 static char *load_file(const char *path, ulong *fsize);
-static ulong write_pages(char** data, ulong pages, uint step);
-static char *encode_message(char *msg, ulong *nbits);
-static char *decode_message(char *bits, ulong nbits);
-static void free_data(ulong fsize, char** data0, char **data1, char **data2);
+static void free_data(ulong fsize, char** data0);
+static uint64_t get_ticks(void);
+static uint64_t ticks_to_ns(uint64_t ticks);
+static ulong write_pages(const struct kmemdupe_config *cfg, char** data, ulong pages, uint step,
+                         struct classify *cls, uint64_t *timings);
+static int get_config(struct kmemdupe_config *cfg);
+static int memdupe_run(void);
+static void round_work(struct work_struct *work);
+static void ksmwalk_range(struct ksmwalk *w, struct mm_struct *mm);
+static uint64_t *encode_message(char *msg, ulong *nbits);
+static char *decode_message(uint64_t *bits, ulong nbits);
+#else
+/* Options for one channel instance, filled in from the command line */
+struct memdupe_config {
+    int role;
+    int sleeptime;
+    const char *filepath;
+    char *message;              /* Payload, not necessarily NUL-free */
+    ulong msglen;
+    int ksmthresh;
+    int readtwice;
+    int timer;
+    int classifier;
+    int fecmode;
+    int nworkers;
+    int hugepolicy;
+    ulong nframes;
+    ulong rounds;
+    long ksmpenalty;
+    const char *tracepath;      /* NULL for no trace file */
+    int ack;                    /* Reverse ACK channel with selective repeat when streaming */
+    int adapt;                  /* AIMD control of the probe lag and page budget when streaming */
+    int noise;                  /* Noise-floor calibration and disturbance filtering */
+};
+#endif
 
 #endif
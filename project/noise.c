@@ -0,0 +1,343 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file noise.c
+ * @headerfile noise.h
+ * @brief Noise-floor calibration and disturbance filtering for page probes.
+ *        The floor is the cost of writing a private page KSM can never merge, so anything
+ *        inside its noise band is not a COW fault. Probes run in windows bracketed by the
+ *        interrupt, preemption and migration counters. A COW fault happens only once, so a
+ *        long page from a disturbed window is written again: if it is still slow, the CPU
+ *        was, and the page is not counted as merged.
+ * @date 10-17-2026
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "noise.h"
+#include "bitvec.h"
+
+#define NOISE_INTERRUPTS "/proc/interrupts"
+#define NOISE_SCHED      "/proc/thread-self/sched"
+#define NOISE_MIGRATIONS "se.nr_migrations"
+
+/**
+ * noise_init
+ * @brief Map the private calibration pages and open the counters. The pages are marked
+ *        unmergeable and filled with distinct content, so they are never shared.
+ * @param n Noise filter to initialize
+ * @param pagesize Bytes per page
+ * @param pages Most pages that will be probed at once
+ * @return 0 on success, -1 on failure
+ */
+int noise_init(struct noise *n, size_t pagesize, unsigned long pages) {
+    unsigned long i;
+
+    memset(n, 0, sizeof(*n));
+    n->irqfd = -1;
+    n->schedfd = -1;
+    n->pagesize = pagesize;
+    n->region = (char *) mmap(NULL, NOISE_PAGES * pagesize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (n->region == MAP_FAILED) {
+        n->region = NULL;
+        return -1;
+    }
+    madvise(n->region, NOISE_PAGES * pagesize, MADV_UNMERGEABLE);
+
+    n->nwindows = (pages + NOISE_WINDOW - 1) / NOISE_WINDOW;
+    n->mask = (uint64_t *) calloc(BITVEC_WORDS(NOISE_PAGES), sizeof(uint64_t));
+    n->disturbed = (uint8_t *) calloc(n->nwindows + 1, 1);
+    n->buf = (char *) malloc(NOISE_BUFSIZE);
+    if (n->mask == NULL || n->disturbed == NULL || n->buf == NULL ||
+        probe_init(&n->probe, NOISE_PAGES, pagesize) < 0) {
+        noise_free(n);
+        return -1;
+    }
+
+    for (i = 0; i < NOISE_PAGES; i++) {
+        bitvec_assign(n->mask, i, 1);
+        memcpy(n->region + i * pagesize, &i, sizeof(i));
+    }
+
+    n->irqfd = open(NOISE_INTERRUPTS, O_RDONLY);
+    n->schedfd = open(NOISE_SCHED, O_RDONLY);
+
+    return 0;
+}
+
+/**
+ * noise_free
+ * @param n Noise filter to free
+ */
+void noise_free(struct noise *n) {
+    if (n->region != NULL) {
+        munmap(n->region, NOISE_PAGES * n->pagesize);
+    }
+    if (n->irqfd >= 0) {
+        close(n->irqfd);
+    }
+    if (n->schedfd >= 0) {
+        close(n->schedfd);
+    }
+    if (n->probe.ticks != NULL) {
+        probe_free(&n->probe);
+    }
+    free(n->mask);
+    free(n->disturbed);
+    free(n->buf);
+    memset(n, 0, sizeof(*n));
+    n->irqfd = -1;
+    n->schedfd = -1;
+}
+
+/**
+ * noise_time
+ * @brief Time writes to the first count calibration pages.
+ * @param n Noise filter
+ * @param count Pages to time
+ * @param scratch Scratch space of count entries
+ * @return Median write time, ticks
+ */
+static uint64_t noise_time(struct noise *n, unsigned long count, uint64_t *scratch) {
+    uint64_t mad;
+
+    probe_prefault(&n->probe, n->region, 0, count);
+    probe_stripe(&n->probe, n->region, n->mask, 0, count);
+
+    return class_median_mad(n->probe.ticks, count, UINT64_MAX, scratch, &mad);
+}
+
+/**
+ * noise_calibrate
+ * @brief Measure the median and robust sigma of a write to an unshared page over
+ *        NOISE_PASSES passes of the calibration pages.
+ * @param n Noise filter
+ */
+void noise_calibrate(struct noise *n) {
+    uint64_t samples[NOISE_PASSES * NOISE_PAGES];
+    uint64_t scratch[NOISE_PASSES * NOISE_PAGES];
+    uint64_t mad;
+    int pass;
+
+    /* Untimed first pass, so no page still has to be faulted in */
+    noise_time(n, NOISE_PAGES, scratch);
+    for (pass = 0; pass < NOISE_PASSES; pass++) {
+        noise_time(n, NOISE_PAGES, scratch);
+        memcpy(samples + pass * NOISE_PAGES, n->probe.ticks, NOISE_PAGES * sizeof(uint64_t));
+    }
+
+    n->floor = class_median_mad(samples, NOISE_PASSES * NOISE_PAGES, UINT64_MAX, scratch, &mad);
+    n->floor = (n->floor > 0) ? n->floor : 1;
+    n->sigma = mad * CLASS_MAD_SCALE / 1000;
+    n->sigma = (n->sigma > 0) ? n->sigma : 1;
+    n->current = n->floor;
+}
+
+/**
+ * noise_irqs
+ * @brief Sum the interrupts taken by one CPU from /proc/interrupts.
+ * @param n Noise filter
+ * @param cpu CPU
+ * @return Interrupts so far, 0 if unreadable
+ */
+static uint64_t noise_irqs(struct noise *n, int cpu) {
+    char name[16], *line, *end, *p, *q, *save;
+    uint64_t total = 0, value = 0;
+    long col = -1, i;
+    ssize_t len;
+
+    if (n->irqfd < 0 || (len = pread(n->irqfd, n->buf, NOISE_BUFSIZE - 1, 0)) <= 0) {
+        return 0;
+    }
+    n->buf[len] = '\0';
+
+    /* The header names the column of each online CPU */
+    end = strchr(n->buf, '\n');
+    if (end == NULL) {
+        return 0;
+    }
+    *end = '\0';
+    snprintf(name, sizeof(name), "CPU%d", cpu);
+    for (i = 0, p = strtok_r(n->buf, " ", &save); p != NULL; p = strtok_r(NULL, " ", &save), i++) {
+        if (strcmp(p, name) == 0) {
+            col = i;
+        }
+    }
+    if (col < 0) {
+        return 0;
+    }
+
+    for (line = end + 1; line != NULL && *line != '\0'; line = (end != NULL) ? end + 1 : NULL) {
+        end = strchr(line, '\n');
+        if (end != NULL) {
+            *end = '\0';
+        }
+
+        /* Skip the label, then take the CPU's column if the line has one */
+        p = strchr(line, ':');
+        for (i = 0; p != NULL && i <= col; i++) {
+            value = strtoull(p + (i == 0), &q, 10);
+            if (q == p + (i == 0)) {
+                break;
+            }
+            p = q;
+        }
+        if (p != NULL && i > col) {
+            total += value;
+        }
+    }
+
+    return total;
+}
+
+/**
+ * noise_migrations
+ * @return Scheduler migrations of the calling thread, 0 if unreadable
+ */
+static long noise_migrations(struct noise *n) {
+    ssize_t len;
+    char *p;
+
+    if (n->schedfd < 0 || (len = pread(n->schedfd, n->buf, NOISE_BUFSIZE - 1, 0)) <= 0) {
+        return 0;
+    }
+    n->buf[len] = '\0';
+
+    p = strstr(n->buf, NOISE_MIGRATIONS);
+    p = (p != NULL) ? strchr(p, ':') : NULL;
+
+    return (p != NULL) ? strtol(p + 1, NULL, 10) : 0;
+}
+
+/**
+ * noise_mark
+ * @brief Read the counters that reveal a disturbance.
+ * @param n Noise filter
+ * @param m Output
+ */
+void noise_mark(struct noise *n, struct noise_mark *m) {
+    struct rusage ru;
+
+    m->cpu = sched_getcpu();
+    m->irqs = noise_irqs(n, m->cpu);
+    m->nivcsw = (getrusage(RUSAGE_THREAD, &ru) == 0) ? ru.ru_nivcsw : 0;
+    m->migrations = noise_migrations(n);
+}
+
+/**
+ * noise_disturbed
+ * @param before Counters before a window
+ * @param after Counters after it
+ * @return Disturbance sources seen in between, 0 if none
+ */
+int noise_disturbed(const struct noise_mark *before, const struct noise_mark *after) {
+    int sources = 0;
+
+    if (before->cpu != after->cpu || after->migrations != before->migrations) {
+        sources |= NOISE_MIGRATE;
+    } else if (after->irqs != before->irqs) {
+        sources |= NOISE_IRQ;
+    }
+    if (after->nivcsw != before->nivcsw) {
+        sources |= NOISE_PREEMPT;
+    }
+
+    return sources;
+}
+
+/**
+ * noise_probe
+ * @brief Re-time the floor, then probe in windows of NOISE_WINDOW pages, recording which
+ *        windows were disturbed. Counters are read only between windows.
+ * @param n Noise filter
+ * @param probe Probe holding the timing array
+ * @param data Base of the probed region
+ * @param mask Packed per-page write bits
+ * @param pages Number of pages
+ * @return Ticks spent writing the pages
+ */
+uint64_t noise_probe(struct noise *n, struct probe *probe, char *data, const uint64_t *mask, unsigned long pages) {
+    uint64_t scratch[NOISE_CHECK];
+    struct noise_mark before, after;
+    unsigned long first, count, w;
+    uint64_t ticks = 0;
+
+    /* The floor moves with the CPU clock */
+    n->current = noise_time(n, NOISE_CHECK, scratch);
+    n->windows = 0;
+    n->ndisturbed = 0;
+    n->sources = 0;
+    n->reprobed = 0;
+    n->cleared = 0;
+
+    probe_prefault(probe, data, 0, pages);
+    noise_mark(n, &before);
+    for (first = 0, w = 0; first < pages && w < n->nwindows; first += count, w++) {
+        count = (pages - first < NOISE_WINDOW) ? pages - first : NOISE_WINDOW;
+        ticks += probe_stripe(probe, data, mask, first, count);
+
+        noise_mark(n, &after);
+        n->disturbed[w] = noise_disturbed(&before, &after);
+        n->ndisturbed += (n->disturbed[w] != 0);
+        n->sources |= n->disturbed[w];
+        before = after;
+    }
+    n->windows = w;
+
+    /* Beyond the windows sized at init, probe without checks */
+    if (first < pages) {
+        ticks += probe_stripe(probe, data, mask, first, pages - first);
+    }
+
+    return ticks;
+}
+
+/**
+ * noise_filter
+ * @brief Clear long pages that are not COW faults: those inside the noise band above the
+ *        current floor, and those from disturbed windows that are still slow when written
+ *        again.
+ * @param n Noise filter, after noise_probe
+ * @param probe Probe holding the timing array
+ * @param data Base of the probed region
+ * @param cls Classifier results, updated
+ * @param islong Per-page classification, updated
+ * @param conf Per-page confidence, set to 0 where cleared (may be NULL)
+ * @param pages Number of pages
+ */
+void noise_filter(struct noise *n, struct probe *probe, char *data, struct classify *cls,
+                  uint8_t *islong, uint16_t *conf, unsigned long pages) {
+    uint64_t guard;
+    unsigned long i;
+    int clear;
+
+    guard = n->current + cls->k * n->sigma * n->current / n->floor;
+    for (i = 0; i < pages; i++) {
+        if (!islong[i]) {
+            continue;
+        }
+
+        clear = (probe->ticks[i] <= guard);
+        if (!clear && i / NOISE_WINDOW < n->windows && n->disturbed[i / NOISE_WINDOW]) {
+            probe_stripe(&n->probe, data + i * n->pagesize, n->mask, 0, 1);
+            n->reprobed++;
+            clear = (n->probe.ticks[0] > cls->threshold);
+        }
+
+        if (clear) {
+            islong[i] = 0;
+            cls->nlong--;
+            n->cleared++;
+            if (conf != NULL) {
+                conf[i] = 0;
+            }
+        }
+    }
+}
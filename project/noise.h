@@ -0,0 +1,68 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file noise.h
+ * @brief Noise-floor calibration and disturbance filtering for page probes.
+ * @date 10-17-2026
+ */
+#ifndef _NOISE_H_
+#define _NOISE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "probe.h"
+#include "classify.h"
+
+#define NOISE_PAGES    256     /* Private calibration pages */
+#define NOISE_PASSES   4       /* Timed passes over them */
+#define NOISE_CHECK    32      /* Calibration pages re-timed before each probe to track the floor */
+#define NOISE_WINDOW   64      /* Pages probed between disturbance checks */
+#define NOISE_DRIFT    125     /* Warn when the floor moves to this % of its calibrated value */
+#define NOISE_BUFSIZE  65536   /* Bytes of /proc/interrupts read */
+
+/* Disturbance sources */
+#define NOISE_IRQ      1       /* Interrupts on the probing CPU */
+#define NOISE_PREEMPT  2       /* Involuntary context switches */
+#define NOISE_MIGRATE  4       /* Moved to another CPU */
+
+/* Counters read around each probe window */
+struct noise_mark {
+    int cpu;
+    uint64_t irqs;                /* Interrupts on cpu so far */
+    long nivcsw;                  /* Involuntary context switches of this thread */
+    long migrations;              /* Scheduler migrations of this thread */
+};
+
+struct noise {
+    char *region;                 /* Private, non-mergeable calibration pages */
+    size_t pagesize;
+    struct probe probe;           /* Timing array for the calibration pages */
+    uint64_t *mask;               /* Every calibration page */
+    uint64_t floor;               /* Calibrated median write to an unshared page, ticks */
+    uint64_t sigma;               /* Calibrated robust sigma, ticks */
+    uint64_t current;             /* Floor re-timed before the last probe, ticks */
+    uint8_t *disturbed;           /* Sources seen in each window of the last probe */
+    unsigned long nwindows;       /* Capacity of disturbed */
+    int irqfd;                    /* /proc/interrupts, -1 if unreadable */
+    int schedfd;                  /* /proc/thread-self/sched, -1 if unreadable */
+    char *buf;                    /* Read buffer for both */
+
+    /* Statistics for the last probe */
+    unsigned long windows;        /* Windows probed */
+    unsigned long ndisturbed;     /* ...of which disturbed */
+    unsigned long sources;        /* Union of the sources seen */
+    unsigned long reprobed;       /* Long pages in disturbed windows written again */
+    unsigned long cleared;        /* Long pages found not to be COW faults */
+};
+
+int noise_init(struct noise *n, size_t pagesize, unsigned long pages);
+void noise_free(struct noise *n);
+void noise_calibrate(struct noise *n);
+void noise_mark(struct noise *n, struct noise_mark *m);
+int noise_disturbed(const struct noise_mark *before, const struct noise_mark *after);
+uint64_t noise_probe(struct noise *n, struct probe *probe, char *data, const uint64_t *mask, unsigned long pages);
+void noise_filter(struct noise *n, struct probe *probe, char *data, struct classify *cls,
+                  uint8_t *islong, uint16_t *conf, unsigned long pages);
+
+#endif
@@ -0,0 +1,331 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file packet.c
+ * @headerfile packet.h
+ * @brief Framing for covert channel messages: sync preamble, header and CRC32C per packet.
+ * @date 10-17-2026
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <cpuid.h>
+#include <nmmintrin.h>
+
+#include "packet.h"
+#include "bitvec.h"
+
+#define CPUID_FEATURES   1
+#define CPUID_SSE42_BIT  20
+#define CRC32C_POLY      0x82F63B78U  /* Castagnoli, reflected */
+
+static uint32_t _crc_table[256];
+static int _crc_sse42 = -1;
+
+/**
+ * packet_init
+ * @brief Check CPUID for the SSE4.2 crc32 instruction and build the table for the fallback.
+ */
+void packet_init(void) {
+    unsigned int eax, ebx, ecx, edx;
+    uint32_t crc;
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        }
+        _crc_table[i] = crc;
+    }
+
+    _crc_sse42 = 0;
+    if (__get_cpuid(CPUID_FEATURES, &eax, &ebx, &ecx, &edx)) {
+        _crc_sse42 = (ecx >> CPUID_SSE42_BIT) & 1;
+    }
+}
+
+/**
+ * crc32c_sse42
+ * @brief CRC32C with the SSE4.2 crc32 instruction, eight bytes at a time.
+ * @param crc Running CRC (inverted)
+ * @param p Bytes
+ * @param len Number of bytes
+ * @return Updated running CRC (inverted)
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, unsigned long len) {
+    uint64_t c = crc, w;
+
+    for (; len >= sizeof(w); len -= sizeof(w), p += sizeof(w)) {
+        memcpy(&w, p, sizeof(w));
+        c = _mm_crc32_u64(c, w);
+    }
+    for (; len > 0; len--) {
+        c = _mm_crc32_u8((uint32_t) c, *p++);
+    }
+
+    return (uint32_t) c;
+}
+
+/**
+ * crc32c_table
+ * @brief CRC32C a byte at a time from the table, for CPUs without SSE4.2.
+ * @param crc Running CRC (inverted)
+ * @param p Bytes
+ * @param len Number of bytes
+ * @return Updated running CRC (inverted)
+ */
+static uint32_t crc32c_table(uint32_t crc, const uint8_t *p, unsigned long len) {
+    for (; len > 0; len--) {
+        crc = (crc >> 8) ^ _crc_table[(crc ^ *p++) & 0xff];
+    }
+
+    return crc;
+}
+
+/**
+ * packet_crc32c
+ * @brief CRC32C (Castagnoli) of a buffer; chain calls by passing the previous result.
+ * @param crc 0, or the CRC of the preceding bytes
+ * @param buf Bytes
+ * @param len Number of bytes
+ * @return CRC32C
+ */
+uint32_t packet_crc32c(uint32_t crc, const void *buf, unsigned long len) {
+    if (_crc_sse42 < 0) {
+        packet_init();
+    }
+
+    crc = ~crc;
+    crc = _crc_sse42 ? crc32c_sse42(crc, (const uint8_t *) buf, len)
+                     : crc32c_table(crc, (const uint8_t *) buf, len);
+
+    return ~crc;
+}
+
+/**
+ * packet_count
+ * @param msglen Message bytes
+ * @return Packets needed to carry the message, at most PACKET_MAX
+ */
+unsigned long packet_count(unsigned long msglen) {
+    unsigned long count = (msglen + PACKET_PAYLOAD - 1) / PACKET_PAYLOAD;
+
+    if (count == 0) {
+        return 1;
+    }
+
+    return (count < PACKET_MAX) ? count : PACKET_MAX;
+}
+
+/**
+ * packet_put
+ * @brief Frame one packet of the message.
+ * @param buf Output buffer
+ * @param space Bytes left in the buffer
+ * @param msg Message
+ * @param msglen Message bytes
+ * @param seq Packet to frame
+ * @return Bytes written, 0 if the packet does not fit
+ */
+unsigned long packet_put(char *buf, unsigned long space, const char *msg, unsigned long msglen, unsigned long seq) {
+    unsigned long count = packet_count(msglen);
+    unsigned long offset = seq * PACKET_PAYLOAD;
+    unsigned long len = (msglen - offset < PACKET_PAYLOAD) ? msglen - offset : PACKET_PAYLOAD;
+    uint8_t *p = (uint8_t *) buf;
+    uint32_t crc;
+
+    if (PACKET_OVERHEAD + len > space) {
+        return 0;
+    }
+
+    p[0] = (PACKET_SYNC >> 24) & 0xff;
+    p[1] = (PACKET_SYNC >> 16) & 0xff;
+    p[2] = (PACKET_SYNC >> 8) & 0xff;
+    p[3] = PACKET_SYNC & 0xff;
+    p[4] = seq >> 8;
+    p[5] = seq;
+    p[6] = count >> 8;
+    p[7] = count;
+    p[8] = len;
+    memcpy(p + 9, msg + offset, len);
+
+    crc = packet_crc32c(0, p + 4, PACKET_HEADER + len);
+    p[9 + len] = crc >> 24;
+    p[10 + len] = crc >> 16;
+    p[11 + len] = crc >> 8;
+    p[12 + len] = crc;
+
+    return PACKET_OVERHEAD + len;
+}
+
+/**
+ * packet_build
+ * @brief Frame as many packets of the message as fit, starting at packet *seq.
+ * @param msg Message
+ * @param msglen Message bytes
+ * @param seq Next packet to send, advanced past the packets built
+ * @param capacity Bytes available
+ * @param nbytes Set to the bytes used
+ * @return Buffer of packets (capacity bytes), NULL on error
+ */
+char *packet_build(const char *msg, unsigned long msglen, unsigned long *seq,
+                   unsigned long capacity, unsigned long *nbytes) {
+    unsigned long count = packet_count(msglen);
+    unsigned long len;
+    char *buf;
+
+    *nbytes = 0;
+    buf = (char *) calloc(capacity + 1, 1);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    for (; *seq < count; (*seq)++) {
+        len = packet_put(buf + *nbytes, capacity - *nbytes, msg, msglen, *seq);
+        if (len == 0) {
+            break;
+        }
+        *nbytes += len;
+    }
+
+    return buf;
+}
+
+/**
+ * packet_byte
+ * @param bits Bit vector
+ * @param offset Bit offset, not necessarily byte-aligned
+ * @return The 8 bits at offset, MSB first
+ */
+static uint8_t packet_byte(const uint64_t *bits, unsigned long offset) {
+    uint8_t b = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        b = (b << 1) | bitvec_get(bits, offset + i);
+    }
+
+    return b;
+}
+
+/**
+ * packet_reset
+ * @brief Size the reassembly buffer for a message of count packets, shown as PACKET_FILL.
+ * @param rx Receive state
+ * @param count Packets in the message
+ * @return 0 on success, -1 on failure
+ */
+static int packet_reset(struct packet_rx *rx, unsigned long count) {
+    unsigned long nbytes = count * PACKET_PAYLOAD;
+    char *fill;
+
+    packet_rx_free(rx);
+    rx->bits = (uint64_t *) calloc(BITVEC_WORDS(nbytes * 8) + 1, sizeof(uint64_t));
+    rx->have = (uint64_t *) calloc(BITVEC_WORDS(count), sizeof(uint64_t));
+    fill = (char *) malloc(nbytes);
+    if (rx->bits == NULL || rx->have == NULL || fill == NULL) {
+        free(fill);
+        packet_rx_free(rx);
+        return -1;
+    }
+
+    memset(fill, PACKET_FILL, nbytes);
+    bitvec_pack(rx->bits, fill, nbytes);
+    free(fill);
+
+    rx->count = count;
+    rx->msglen = nbytes;
+
+    return 0;
+}
+
+/**
+ * packet_parse
+ * @brief Search the bits for preambles, allowing PACKET_SYNC_ERRS bit errors, and keep
+ *        every packet that passes its CRC. After a bad packet the search resumes right
+ *        behind its preamble, since its length cannot be trusted.
+ * @param rx Receive state, accumulated across calls
+ * @param bits Decoded channel bits
+ * @param nbits Number of bits
+ * @return Packets that passed the CRC
+ */
+unsigned long packet_parse(struct packet_rx *rx, const uint64_t *bits, unsigned long nbits) {
+    uint8_t buf[PACKET_HEADER + 255 + PACKET_CRC];
+    unsigned long i, j, start = 0, offset, seq, count, len, ngood = 0;
+    uint32_t window = 0, crc;
+
+    for (i = 0; i < nbits; i++) {
+        window = (window << 1) | bitvec_get(bits, i);
+        if (i + 1 - start < PACKET_SYNC_BITS || __builtin_popcount(window ^ PACKET_SYNC) > PACKET_SYNC_ERRS) {
+            continue;
+        }
+
+        /* Header, then payload and CRC once the length is known */
+        offset = i + 1;
+        if (offset + (PACKET_HEADER + PACKET_CRC) * 8 > nbits) {
+            break;
+        }
+        for (j = 0; j < PACKET_HEADER; j++) {
+            buf[j] = packet_byte(bits, offset + j * 8);
+        }
+        len = buf[4];
+        if (offset + (PACKET_HEADER + len + PACKET_CRC) * 8 > nbits) {
+            rx->bad++;
+            start = offset;
+            continue;
+        }
+        for (j = PACKET_HEADER; j < PACKET_HEADER + len + PACKET_CRC; j++) {
+            buf[j] = packet_byte(bits, offset + j * 8);
+        }
+
+        crc = ((uint32_t) buf[PACKET_HEADER + len] << 24) | ((uint32_t) buf[PACKET_HEADER + len + 1] << 16) |
+              ((uint32_t) buf[PACKET_HEADER + len + 2] << 8) | buf[PACKET_HEADER + len + 3];
+        seq = ((unsigned long) buf[0] << 8) | buf[1];
+        count = ((unsigned long) buf[2] << 8) | buf[3];
+        if (crc != packet_crc32c(0, buf, PACKET_HEADER + len) || seq >= count || len > PACKET_PAYLOAD ||
+            (seq + 1 < count && len != PACKET_PAYLOAD)) {
+            rx->bad++;
+            start = offset;
+            continue;
+        }
+
+        /* A different packet count means a new message */
+        if (count != rx->count && packet_reset(rx, count) < 0) {
+            break;
+        }
+
+        /* Packets start on whole words, so the payload packs straight into place */
+        bitvec_pack(rx->bits + seq * PACKET_PAYLOAD / BITVEC_WORD_BYTES, (const char *) buf + PACKET_HEADER, len);
+        if (seq + 1 == count) {
+            rx->msglen = seq * PACKET_PAYLOAD + len;
+        }
+        if (!bitvec_get(rx->have, seq)) {
+            bitvec_assign(rx->have, seq, 1);
+            rx->nhave++;
+        }
+        rx->good++;
+        rx->payload += len;
+        ngood++;
+
+        i = offset + (PACKET_HEADER + len + PACKET_CRC) * 8 - 1;
+        start = i + 1;
+    }
+
+    return ngood;
+}
+
+/**
+ * packet_rx_free
+ * @brief Release the reassembly buffer and forget the message.
+ * @param rx Receive state
+ */
+void packet_rx_free(struct packet_rx *rx) {
+    free(rx->bits);
+    free(rx->have);
+    rx->bits = NULL;
+    rx->have = NULL;
+    rx->count = 0;
+    rx->msglen = 0;
+    rx->nhave = 0;
+}
@@ -0,0 +1,50 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file packet.h
+ * @brief Framing for covert channel messages: sync preamble, header and CRC32C per packet.
+ *        (Packets, so as not to be confused with the carrier frames of stream.h.)
+ * @date 10-17-2026
+ */
+#ifndef _PACKET_H_
+#define _PACKET_H_
+
+#include <stdint.h>
+
+/*
+ * Wire format, MSB of each byte first:
+ *   sync[4] seq[2] count[2] len[1] payload[len] crc[4]
+ * seq is the packet's index in the message and count the number of packets in it.
+ * The CRC32C covers the header and payload.
+ */
+#define PACKET_SYNC      0x1ACFFC1DU  /* CCSDS attached sync marker: low autocorrelation */
+#define PACKET_SYNC_BITS 32
+#define PACKET_SYNC_ERRS 3            /* Preamble bit errors tolerated when searching */
+#define PACKET_HEADER    5            /* seq, count, len */
+#define PACKET_CRC       4
+#define PACKET_OVERHEAD  (PACKET_SYNC_BITS / 8 + PACKET_HEADER + PACKET_CRC)
+#define PACKET_PAYLOAD   64           /* Message bytes per packet, at most 255 */
+#define PACKET_MAX       65535        /* Packets per message */
+#define PACKET_FILL      '?'          /* Shown in place of packets not yet received */
+
+struct packet_rx {
+    unsigned long count;          /* Packets in the message, 0 until a header is seen */
+    unsigned long msglen;         /* Message bytes, known once the last packet arrives */
+    uint64_t *bits;               /* Reassembled message, packed like encode_message */
+    uint64_t *have;               /* Packets received, one bit per seq */
+    unsigned long nhave;          /* Distinct packets received */
+    unsigned long good;           /* Packets that passed the CRC */
+    unsigned long payload;        /* Payload bytes of the packets that passed the CRC */
+    unsigned long bad;            /* Preambles found whose packet failed the CRC */
+};
+
+void packet_init(void);
+uint32_t packet_crc32c(uint32_t crc, const void *buf, unsigned long len);
+unsigned long packet_count(unsigned long msglen);
+unsigned long packet_put(char *buf, unsigned long space, const char *msg, unsigned long msglen, unsigned long seq);
+char *packet_build(const char *msg, unsigned long msglen, unsigned long *seq,
+                   unsigned long capacity, unsigned long *nbytes);
+unsigned long packet_parse(struct packet_rx *rx, const uint64_t *bits, unsigned long nbits);
+void packet_rx_free(struct packet_rx *rx);
+
+#endif
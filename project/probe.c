@@ -0,0 +1,116 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file probe.c
+ * @headerfile probe.h
+ * @brief Batched page probe engine: pre-fault, then time writes to a stripe of pages.
+ * @date 10-17-2026
+ */
+#include "probe.h"
+#include "timer.h"
+#include "bitvec.h"
+#include "hugepage.h"
+
+/**
+ * probe_init
+ * @brief Preallocate the timing array so nothing is allocated while timing. It is backed
+ *        by huge pages when the policy allows, to cut TLB misses in the probe loop.
+ * @param probe Probe to initialize
+ * @param pages Number of pages that will be probed
+ * @param pagesize Bytes per page
+ * @return 0 on success, -1 if the timing array could not be allocated
+ */
+int probe_init(struct probe *probe, unsigned long pages, size_t pagesize) {
+    probe->pages = pages;
+    probe->pagesize = pagesize;
+    probe->ticks = (uint64_t *) hugepage_alloc(pages * sizeof(uint64_t));
+
+    return (probe->ticks != NULL) ? 0 : -1;
+}
+
+/**
+ * probe_free
+ * @brief Release the timing array.
+ * @param probe Probe to free
+ */
+void probe_free(struct probe *probe) {
+    hugepage_free(probe->ticks, probe->pages * sizeof(uint64_t));
+    probe->ticks = NULL;
+    probe->pages = 0;
+}
+
+/**
+ * probe_prefault
+ * @brief Read one byte of every page so that only copy-on-write faults remain for the timed writes.
+ * @param probe Probe describing the page size
+ * @param data Base of the probed region
+ * @param first First page of the stripe
+ * @param count Number of pages in the stripe
+ */
+void probe_prefault(struct probe *probe, char *data, unsigned long first, unsigned long count) {
+    volatile char *page = (volatile char *) data + (first + 1) * probe->pagesize - 1;
+    unsigned long i;
+    char sink = 0;
+
+    for (i = 0; i < count; i++) {
+        sink ^= *page;
+        page += probe->pagesize;
+    }
+    (void) sink;
+}
+
+/**
+ * probe_loop
+ * @brief Timed write loop, specialized per timer backend so the read is inlined.
+ *        Each timestamp both ends one page and starts the next: one timer read per page.
+ * @param probe Probe holding the timing array
+ * @param data Base of the probed region
+ * @param mask Packed per-page write bits (indexed from page 0 of the region)
+ * @param first First page of the stripe
+ * @param count Number of pages in the stripe
+ * @param backend Timer backend (a constant at each call site)
+ * @return Ticks spent writing the stripe
+ */
+static inline __attribute__((always_inline))
+uint64_t probe_loop(struct probe *probe, char *data, const uint64_t *mask,
+                unsigned long first, unsigned long count, int backend) {
+    char *page = data + (first + 1) * probe->pagesize - 1;
+    uint64_t *ticks = probe->ticks + first;
+    uint64_t start, prev, now;
+    unsigned long i;
+
+    start = prev = timer_read_backend(backend);
+    for (i = 0; i < count; i++) {
+        if (bitvec_get(mask, first + i)) {
+            *(volatile char *) page = PROBE_BYTE;
+        }
+        now = timer_read_backend(backend);
+        ticks[i] = now - prev;
+        prev = now;
+        page += probe->pagesize;
+    }
+
+    return prev - start;
+}
+
+/**
+ * probe_stripe
+ * @brief Write the flagged pages of a stripe, recording per-page ticks. No I/O or
+ *        arithmetic beyond a subtraction happens inside the timed region.
+ * @param probe Probe holding the timing array
+ * @param data Base of the probed region
+ * @param mask Packed per-page write bits (indexed from page 0 of the region)
+ * @param first First page of the stripe
+ * @param count Number of pages in the stripe
+ * @return Ticks spent writing the stripe
+ */
+uint64_t probe_stripe(struct probe *probe, char *data, const uint64_t *mask, unsigned long first, unsigned long count) {
+    switch (timer_backend) {
+        case TIMER_TSC:
+            return probe_loop(probe, data, mask, first, count, TIMER_TSC);
+        case TIMER_MONORAW:
+            return probe_loop(probe, data, mask, first, count, TIMER_MONORAW);
+        default:
+            return probe_loop(probe, data, mask, first, count, TIMER_CPUTIME);
+    }
+}
@@ -0,0 +1,27 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file probe.h
+ * @brief Batched page probe engine: pre-fault, then time writes to a stripe of pages.
+ * @date 10-17-2026
+ */
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROBE_BYTE '.'
+
+struct probe {
+    unsigned long pages;     /* Capacity of the timing array */
+    size_t pagesize;         /* Bytes per page */
+    uint64_t *ticks;         /* Per-page write time in timer ticks */
+};
+
+int probe_init(struct probe *probe, unsigned long pages, size_t pagesize);
+void probe_free(struct probe *probe);
+void probe_prefault(struct probe *probe, char *data, unsigned long first, unsigned long count);
+uint64_t probe_stripe(struct probe *probe, char *data, const uint64_t *mask, unsigned long first, unsigned long count);
+
+#endif
@@ -0,0 +1,144 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file rate.c
+ * @headerfile rate.h
+ * @brief AIMD rate control for streaming: probe lag and page budget from measured errors.
+ *        The Receiver runs the controller once per probed frame. A clean round grows the
+ *        page budget by one packet and, after RATE_PATIENCE clean rounds, shortens the lag by
+ *        an epoch; any error halves the budget and doubles the lag. The lag is the Receiver's
+ *        alone, while the budget reaches the Sender in the ACK.
+ * @date 10-17-2026
+ */
+#include "rate.h"
+#include "stream.h"
+
+#define RATE_PPM 1000000UL
+#define RATE_HAMMING_N 7
+
+/**
+ * rate_init
+ * @brief Start cautiously: the smallest budget and the longest lag. The error target is a
+ *        fraction of what the FEC mode corrects; without FEC any lost packet is an error.
+ * @param r Controller to initialize
+ * @param mode FEC mode
+ * @param minpages Smallest page budget
+ * @param maxpages Largest page budget
+ * @param maxlag Longest lag in epochs
+ */
+void rate_init(struct rate *r, int mode, unsigned long minpages, unsigned long maxpages, long maxlag) {
+    r->minpages = (minpages < maxpages) ? minpages : maxpages;
+    r->maxpages = maxpages;
+    r->pages = r->minpages;
+    r->maxlag = (maxlag > 1) ? maxlag : 1;
+    r->lag = r->maxlag;
+    r->clean = 0;
+    r->ppm = 0;
+    r->weakppm = 0;
+
+    switch (mode) {
+        case FEC_HAMMING:
+            r->target = RATE_PPM / RATE_HAMMING_N / RATE_MARGIN;
+            break;
+        case FEC_RS:
+            r->target = RATE_PPM * (FEC_RS_ROOTS / 2) / (FEC_RS_MAXLEN * 8) / RATE_MARGIN;
+            break;
+        default:
+            r->target = 0;
+            break;
+    }
+}
+
+/**
+ * rate_errors
+ * @brief Estimate the raw channel errors behind one decode. An uncorrectable Reed-Solomon
+ *        block had more errors than the code could fix, so it counts as one more than that.
+ * @param mode FEC mode
+ * @param stats Decode statistics
+ * @return Estimated bit errors
+ */
+unsigned long rate_errors(int mode, const struct fec_stats *stats) {
+    return stats->corrected + ((mode == FEC_RS) ? stats->failed * (FEC_RS_ROOTS / 2 + 1) : stats->failed);
+}
+
+/**
+ * rate_update
+ * @brief Feed one round's measurements to the controller.
+ * @param r Controller
+ * @param errors Estimated channel bit errors
+ * @param bits Channel bits they were measured over
+ * @param lost Codewords or packets lost outright
+ * @param weak Pages the classifier could not separate with confidence
+ * @param pages Pages probed
+ * @return RATE_UP, RATE_DOWN or RATE_HOLD
+ */
+int rate_update(struct rate *r, unsigned long errors, unsigned long bits, unsigned long lost,
+                unsigned long weak, unsigned long pages) {
+    r->ppm = (bits > 0) ? errors * RATE_PPM / bits : RATE_PPM;
+    r->weakppm = (pages > 0) ? weak * RATE_PPM / pages : RATE_PPM;
+
+    /* Multiplicative decrease */
+    if (lost > 0 || r->ppm > r->target || r->weakppm > RATE_WEAK_PPM) {
+        r->pages = (r->pages / 2 / STREAM_ALIGN) * STREAM_ALIGN;
+        r->pages = (r->pages > r->minpages) ? r->pages : r->minpages;
+        r->lag = (r->lag * 2 < r->maxlag) ? r->lag * 2 : r->maxlag;
+        r->clean = 0;
+        return RATE_DOWN;
+    }
+
+    /* Additive increase */
+    r->clean++;
+    if (r->pages >= r->maxpages && (r->lag <= 1 || r->clean < RATE_PATIENCE)) {
+        return RATE_HOLD;
+    }
+
+    r->pages = (r->pages + r->minpages < r->maxpages) ? r->pages + r->minpages : r->maxpages;
+    if (r->clean >= RATE_PATIENCE && r->lag > 1) {
+        r->lag--;
+        r->clean = 0;
+    }
+
+    return RATE_UP;
+}
+
+/**
+ * rate_put
+ * @brief Append the page budget to an ACK.
+ * @param r Controller
+ * @param buf Output, RATE_ACK_BYTES bytes
+ * @return RATE_ACK_BYTES
+ */
+unsigned long rate_put(const struct rate *r, char *buf) {
+    unsigned long words = r->pages / STREAM_ALIGN;
+
+    buf[0] = words >> 8;
+    buf[1] = words;
+
+    return RATE_ACK_BYTES;
+}
+
+/**
+ * rate_get
+ * @brief Take the page budget from an ACK, within the controller's limits.
+ * @param r Controller
+ * @param buf RATE_ACK_BYTES bytes from the ACK
+ */
+void rate_get(struct rate *r, const char *buf) {
+    const unsigned char *p = (const unsigned char *) buf;
+    unsigned long pages = (((unsigned long) p[0] << 8) | p[1]) * STREAM_ALIGN;
+
+    r->pages = (pages < r->minpages) ? r->minpages : (pages > r->maxpages) ? r->maxpages : pages;
+}
+
+/**
+ * rate_name
+ * @param outcome Outcome of a round
+ * @return Printable outcome
+ */
+const char *rate_name(int outcome) {
+    switch (outcome) {
+        case RATE_UP:   return "up";
+        case RATE_DOWN: return "down";
+        default:        return "hold";
+    }
+}
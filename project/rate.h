@@ -0,0 +1,43 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file rate.h
+ * @brief AIMD rate control for streaming: probe lag and page budget from measured errors.
+ * @date 10-17-2026
+ */
+#ifndef _RATE_H_
+#define _RATE_H_
+
+#include "fec.h"
+
+#define RATE_MARGIN     4       /* Back off beyond this fraction of the errors FEC can correct */
+#define RATE_WEAK_PPM   10000   /* Weak (poorly separated) bits tolerated */
+#define RATE_PATIENCE   4       /* Clean rounds in a row before the lag is shortened */
+#define RATE_ACK_BYTES  2       /* Page budget appended to the ACK, in STREAM_ALIGN pages */
+
+/* Outcome of one round */
+#define RATE_HOLD 0
+#define RATE_UP   1
+#define RATE_DOWN 2
+
+struct rate {
+    unsigned long pages;          /* Frame pages the Sender may fill */
+    unsigned long minpages;       /* Smallest budget: one packet after FEC */
+    unsigned long maxpages;       /* Whole frame */
+    long lag;                     /* Epochs from a frame's write to its probe */
+    long maxlag;                  /* Longest lag before the frame is reused */
+    unsigned long target;         /* Error rate tolerated, ppm */
+    unsigned long clean;          /* Clean rounds in a row */
+    unsigned long ppm;            /* Last round's error rate */
+    unsigned long weakppm;        /* Last round's weak bit rate */
+};
+
+void rate_init(struct rate *r, int mode, unsigned long minpages, unsigned long maxpages, long maxlag);
+unsigned long rate_errors(int mode, const struct fec_stats *stats);
+int rate_update(struct rate *r, unsigned long errors, unsigned long bits, unsigned long lost,
+                unsigned long weak, unsigned long pages);
+unsigned long rate_put(const struct rate *r, char *buf);
+void rate_get(struct rate *r, const char *buf);
+const char *rate_name(int outcome);
+
+#endif
@@ -0,0 +1,101 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file stream.c
+ * @headerfile stream.h
+ * @brief Continuous streaming over a carrier split into rotating, re-keyed frames.
+ *        Epochs are aligned to the wall clock, so sender and receiver agree on which
+ *        frame carries which epoch without talking. In epoch e the sender re-keys frame
+ *        e % nframes and writes its bits. Half an epoch later the receiver probes the
+ *        frame written nframes - 1 epochs earlier, then re-keys the frame just written.
+ *        The other frames are left alone for ksmd to scan. Neither side keys a frame
+ *        before the sender has written its bits into it: re-keying merged pages faults
+ *        on every page, and a frame that already matched on the other side could be
+ *        merged in full before the bits land.
+ * @date 10-17-2026
+ */
+#include <errno.h>
+#include <time.h>
+
+#include "stream.h"
+#include "carrier.h"
+
+#define STREAM_GAMMA 0xd1b54a32d192ed03ULL
+
+/**
+ * stream_init
+ * @brief Split a carrier into frames.
+ * @param s Stream to initialize
+ * @param data Base of the carrier
+ * @param pages Pages in the carrier
+ * @param pagesize Bytes per page
+ * @param nframes Frames in rotation (at least 2, so one can be probed while another is written)
+ * @param period Seconds per epoch
+ * @param seed Carrier seed
+ * @return 0 on success, -1 if the carrier is too small for the frames
+ */
+int stream_init(struct stream *s, char *data, unsigned long pages, size_t pagesize,
+                unsigned long nframes, int period, uint64_t seed) {
+    if (nframes < 2 || period < 1) {
+        return -1;
+    }
+
+    s->seed = seed;
+    s->data = data;
+    s->pagesize = pagesize;
+    s->nframes = nframes;
+    s->period = period;
+    s->framepages = pages / nframes / STREAM_ALIGN * STREAM_ALIGN;
+
+    return (s->framepages > 0) ? 0 : -1;
+}
+
+/**
+ * stream_frame
+ * @param s Stream
+ * @param epoch Epoch
+ * @return Base of the frame that carries the epoch
+ */
+char *stream_frame(struct stream *s, long epoch) {
+    return s->data + (epoch % s->nframes) * s->framepages * s->pagesize;
+}
+
+/**
+ * stream_epoch
+ * @param s Stream
+ * @return Current epoch: whole periods since the Unix epoch
+ */
+long stream_epoch(struct stream *s) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec / s->period;
+}
+
+/**
+ * stream_wait
+ * @brief Sleep until a point inside an epoch, on the shared wall clock.
+ * @param s Stream
+ * @param epoch Epoch to wait for
+ * @param offset Nanoseconds past the start of the epoch
+ */
+void stream_wait(struct stream *s, long epoch, long offset) {
+    struct timespec ts;
+
+    ts.tv_sec = epoch * s->period + offset / 1000000000L;
+    ts.tv_nsec = offset % 1000000000L;
+    while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/**
+ * stream_rekey
+ * @brief Regenerate the frame that carries an epoch from a key both sides derive from
+ *        (seed, epoch), so content written or merged in earlier epochs is discarded.
+ * @param s Stream
+ * @param epoch Epoch the frame will carry
+ */
+void stream_rekey(struct stream *s, long epoch) {
+    unsigned long first = (epoch % s->nframes) * s->framepages;
+
+    carrier_fill(s->data, first, s->framepages, s->pagesize, s->seed ^ ((uint64_t) epoch * STREAM_GAMMA));
+}
@@ -0,0 +1,32 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file stream.h
+ * @brief Continuous streaming over a carrier split into rotating, re-keyed frames.
+ * @date 10-17-2026
+ */
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STREAM_ALIGN 64   /* Frames start on whole bit vector words */
+
+struct stream {
+    uint64_t seed;                /* Carrier seed the frame keys are derived from */
+    char *data;                   /* Base of the carrier */
+    size_t pagesize;
+    unsigned long nframes;        /* Frames in rotation */
+    unsigned long framepages;     /* Pages per frame */
+    int period;                   /* Seconds per epoch: one frame written and one probed */
+};
+
+int stream_init(struct stream *s, char *data, unsigned long pages, size_t pagesize,
+                unsigned long nframes, int period, uint64_t seed);
+char *stream_frame(struct stream *s, long epoch);
+long stream_epoch(struct stream *s);
+void stream_wait(struct stream *s, long epoch, long offset);
+void stream_rekey(struct stream *s, long epoch);
+
+#endif
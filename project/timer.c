@@ -0,0 +1,140 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file timer.c
+ * @headerfile timer.h
+ * @brief Pluggable low-overhead timer backends for timing page writes.
+ * @date 10-17-2026
+ */
+#include <stdio.h>
+#include <cpuid.h>
+
+#include "timer.h"
+
+#define CPUID_EXT_FEATURES  0x80000001
+#define CPUID_EXT_POWER     0x80000007
+#define CPUID_RDTSCP_BIT    27
+#define CPUID_INVTSC_BIT    8
+
+int timer_backend = TIMER_CPUTIME;
+
+static double _ns_per_tick = 1.0;
+static uint64_t _overhead = 0;
+
+/**
+ * tsc_check
+ * @brief Check CPUID for rdtscp and an invariant TSC.
+ * @param invariant Set to 1 if the TSC runs at a constant rate
+ * @return True if rdtscp is supported
+ */
+static int tsc_check(int *invariant) {
+    unsigned int eax, ebx, ecx, edx;
+    int rdtscp = 0;
+
+    *invariant = 0;
+    if (__get_cpuid(CPUID_EXT_FEATURES, &eax, &ebx, &ecx, &edx)) {
+        rdtscp = (edx >> CPUID_RDTSCP_BIT) & 1;
+    }
+    if (__get_cpuid(CPUID_EXT_POWER, &eax, &ebx, &ecx, &edx)) {
+        *invariant = (edx >> CPUID_INVTSC_BIT) & 1;
+    }
+
+    return rdtscp;
+}
+
+/**
+ * tsc_calibrate
+ * @brief Measure the TSC rate against CLOCK_MONOTONIC_RAW.
+ * @return Nanoseconds per TSC tick
+ */
+static double tsc_calibrate(void) {
+    uint64_t c0, c1, t0, t1;
+
+    t0 = timer_clock(CLOCK_MONOTONIC_RAW);
+    c0 = timer_rdtscp();
+    do {
+        t1 = timer_clock(CLOCK_MONOTONIC_RAW);
+    } while (t1 - t0 < TIMER_CALIB_NS);
+    c1 = timer_rdtscp();
+
+    return (double) (t1 - t0) / (double) (c1 - c0);
+}
+
+/**
+ * measure_overhead
+ * @brief Find the minimum cost of two back-to-back reads of the selected backend.
+ * @return Overhead in ticks
+ */
+static uint64_t measure_overhead(void) {
+    uint64_t t1, t2, best = UINT64_MAX;
+    int i;
+
+    for (i = 0; i < TIMER_OVERHEAD_N; i++) {
+        t1 = timer_read();
+        t2 = timer_read();
+        if (t2 - t1 < best) {
+            best = t2 - t1;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * timer_init
+ * @brief Select and calibrate a timer backend.
+ * @param backend Requested backend (TIMER_AUTO picks the invariant TSC if present)
+ * @return Backend actually selected
+ */
+int timer_init(int backend) {
+    int invariant = 0;
+    int rdtscp = tsc_check(&invariant);
+
+    if (backend == TIMER_AUTO) {
+        backend = (rdtscp && invariant) ? TIMER_TSC : TIMER_MONORAW;
+    } else if (backend == TIMER_TSC && !rdtscp) {
+        printf("<memdupe> Warning: rdtscp not supported, falling back to %s\n", timer_name(TIMER_MONORAW));
+        backend = TIMER_MONORAW;
+    } else if (backend == TIMER_TSC && !invariant) {
+        printf("<memdupe> Warning: TSC is not invariant, timings may drift with frequency\n");
+    } else if (backend < TIMER_CPUTIME || backend > TIMER_MONORAW) {
+        printf("<memdupe> Warning: unknown timer %d, using %s\n", backend, timer_name(TIMER_CPUTIME));
+        backend = TIMER_CPUTIME;
+    }
+
+    timer_backend = backend;
+    _ns_per_tick = (backend == TIMER_TSC) ? tsc_calibrate() : 1.0;
+    _overhead = measure_overhead();
+
+    return backend;
+}
+
+/**
+ * timer_name
+ * @param backend Timer backend
+ * @return Printable backend name
+ */
+const char *timer_name(int backend) {
+    switch (backend) {
+        case TIMER_CPUTIME: return "cputime";
+        case TIMER_TSC:     return "tsc";
+        case TIMER_MONORAW: return "monoraw";
+        default:            return "auto";
+    }
+}
+
+/**
+ * timer_ns_per_tick
+ * @return Calibrated nanoseconds per tick of the selected backend
+ */
+double timer_ns_per_tick(void) {
+    return _ns_per_tick;
+}
+
+/**
+ * timer_overhead
+ * @return Minimum back-to-back read cost of the selected backend (ticks)
+ */
+uint64_t timer_overhead(void) {
+    return _overhead;
+}
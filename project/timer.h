@@ -0,0 +1,87 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file timer.h
+ * @brief Pluggable low-overhead timer backends for timing page writes.
+ * @date 10-17-2026
+ */
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/* Timer backends */
+#define TIMER_AUTO    -1
+#define TIMER_CPUTIME  0    /* clock_gettime(CLOCK_PROCESS_CPUTIME_ID), a syscall per read */
+#define TIMER_TSC      1    /* Serialized rdtscp + lfence, calibrated against CLOCK_MONOTONIC_RAW */
+#define TIMER_MONORAW  2    /* vDSO clock_gettime(CLOCK_MONOTONIC_RAW) */
+
+#define TIMER_CALIB_NS    20000000  /* TSC calibration window (20 ms) */
+#define TIMER_OVERHEAD_N  1000      /* Back-to-back reads used to estimate overhead */
+
+extern int timer_backend;
+
+int timer_init(int backend);
+const char *timer_name(int backend);
+double timer_ns_per_tick(void);
+uint64_t timer_overhead(void);
+
+/**
+ * timer_rdtscp
+ * @brief Read the TSC with rdtscp, fenced so later instructions cannot start early.
+ * @return Current TSC value
+ */
+static inline uint64_t timer_rdtscp(void) {
+    uint32_t lo, hi, aux;
+    asm volatile("rdtscp\n\tlfence" : "=a" (lo), "=d" (hi), "=c" (aux) : : "memory");
+    return ((uint64_t) hi << 32) | lo;
+}
+
+/**
+ * timer_clock
+ * @brief Read a POSIX clock in nanoseconds.
+ * @param clk Clock ID
+ * @return Clock time in nanoseconds
+ */
+static inline uint64_t timer_clock(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * timer_read_backend
+ * @brief Read the given backend; constant-folds when backend is a literal.
+ * @param backend Timer backend
+ * @return Current time in backend ticks
+ */
+static inline uint64_t timer_read_backend(int backend) {
+    if (backend == TIMER_TSC) {
+        return timer_rdtscp();
+    } else if (backend == TIMER_MONORAW) {
+        return timer_clock(CLOCK_MONOTONIC_RAW);
+    }
+    return timer_clock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/**
+ * timer_read
+ * @brief Read the selected backend in raw ticks (convert with timer_to_ns).
+ * @return Current time in backend ticks
+ */
+static inline uint64_t timer_read(void) {
+    return timer_read_backend(timer_backend);
+}
+
+/**
+ * timer_to_ns
+ * @brief Convert a tick count from the selected backend to nanoseconds.
+ * @param ticks Tick count
+ * @return Nanoseconds
+ */
+static inline uint64_t timer_to_ns(uint64_t ticks) {
+    return (uint64_t) (ticks * timer_ns_per_tick() + 0.5);
+}
+
+#endif
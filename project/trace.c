@@ -0,0 +1,172 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file trace.c
+ * @headerfile trace.h
+ * @brief Per-page trace ring and log-linear latency histograms for write_pages. Recording
+ *        is a few relaxed atomics per page; formatting happens once, after the run.
+ * @date 10-17-2026
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+#include "timer.h"
+#include "hugepage.h"
+
+static const char _ops[TRACE_NOPS] = {'W', 'R', 'T'};
+
+/**
+ * trace_init
+ * @brief Clear the histograms and allocate the ring.
+ * @param t Trace to initialize
+ * @param records Ring capacity, rounded up to a power of two (0 keeps histograms only)
+ * @return 0 on success, -1 if the ring could not be allocated
+ */
+int trace_init(struct trace *t, unsigned long records) {
+    unsigned long capacity = 1;
+
+    memset(t, 0, sizeof(*t));
+    if (records == 0) {
+        return 0;
+    }
+
+    while (capacity < records) {
+        capacity <<= 1;
+    }
+
+    t->ring = (struct trace_rec *) hugepage_alloc(capacity * sizeof(struct trace_rec));
+    t->mask = capacity - 1;
+
+    return (t->ring != NULL) ? 0 : -1;
+}
+
+/**
+ * trace_free
+ * @brief Release the ring.
+ * @param t Trace
+ */
+void trace_free(struct trace *t) {
+    if (t->ring != NULL) {
+        hugepage_free(t->ring, (t->mask + 1) * sizeof(struct trace_rec));
+    }
+    t->ring = NULL;
+}
+
+/**
+ * trace_value
+ * @param bucket Bucket index
+ * @return Highest value that falls in the bucket
+ */
+static uint64_t trace_value(unsigned int bucket) {
+    unsigned int shift;
+
+    if (bucket < (1U << TRACE_SUB_BITS)) {
+        return bucket;
+    }
+
+    shift = (bucket >> TRACE_SUB_BITS) - 1;
+    return ((((uint64_t) 1 << TRACE_SUB_BITS) | (bucket & ((1U << TRACE_SUB_BITS) - 1))) << shift)
+           + ((uint64_t) 1 << shift) - 1;
+}
+
+/**
+ * trace_percentile
+ * @param h Histogram
+ * @param permille Percentile in tenths of a percent (500 = median)
+ * @return Latency (ticks) at or below which that share of the pages fall
+ */
+uint64_t trace_percentile(const struct trace_hist *h, unsigned int permille) {
+    uint64_t rank = (h->total * permille + 999) / 1000;
+    uint64_t seen = 0;
+    unsigned int b;
+
+    for (b = 0; b < TRACE_BUCKETS; b++) {
+        seen += h->count[b];
+        if (seen >= rank && seen > 0) {
+            return (trace_value(b) < h->max) ? trace_value(b) : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+/**
+ * trace_report
+ * @brief Print latency percentiles for every op that was recorded.
+ * @param t Trace
+ */
+void trace_report(const struct trace *t) {
+    const struct trace_hist *h;
+    int op;
+
+    for (op = 0; op < TRACE_NOPS; op++) {
+        h = &t->hist[op];
+        if (h->total == 0) {
+            continue;
+        }
+
+        printf("<memdupe> Latency %c: %ld pages, p50 %ld ns, p90 %ld ns, p99 %ld ns, p99.9 %ld ns, max %ld ns\n",
+               _ops[op], h->total, timer_to_ns(trace_percentile(h, 500)), timer_to_ns(trace_percentile(h, 900)),
+               timer_to_ns(trace_percentile(h, 990)), timer_to_ns(trace_percentile(h, 999)), timer_to_ns(h->max));
+    }
+}
+
+/**
+ * trace_dump
+ * @brief Write the ring, oldest record first. A path ending in .csv gets one CSV line per
+ *        record; any other path gets a trace_header followed by the raw records.
+ * @param t Trace
+ * @param path Output file
+ * @return Number of records written, -1 on error
+ */
+int trace_dump(const struct trace *t, const char *path) {
+    const struct trace_rec *rec;
+    struct trace_header header;
+    unsigned long first, count, i;
+    size_t len = strlen(path);
+    int csv = (len >= 4 && strcmp(path + len - 4, ".csv") == 0);
+    FILE *fp;
+
+    if (t->ring == NULL) {
+        return -1;
+    }
+
+    count = (t->head > t->mask + 1) ? t->mask + 1 : t->head;
+    first = t->head - count;
+
+    fp = fopen(path, csv ? "w" : "wb");
+    if (fp == NULL) {
+        printf("<memdupe> Error: Could not open trace file '%s'\n", path);
+        return -1;
+    }
+
+    if (csv) {
+        fprintf(fp, "Op,Round,Page,Time,Ticks,Long?,Conf\n");
+        for (i = first; i < first + count; i++) {
+            rec = &t->ring[i & t->mask];
+            fprintf(fp, "%c,%u,%u,%ld,%lu,%u,%u\n", _ops[rec->op], rec->round, rec->index,
+                    timer_to_ns(rec->ticks), (unsigned long) rec->ticks, rec->islong, rec->conf);
+        }
+    } else {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.recsize = sizeof(struct trace_rec);
+        header.ns_per_tick = timer_ns_per_tick();
+        header.count = count;
+        fwrite(&header, sizeof(header), 1, fp);
+
+        /* The ring may wrap: write the older part, then the newer */
+        i = first & t->mask;
+        if (i + count > t->mask + 1) {
+            fwrite(&t->ring[i], sizeof(struct trace_rec), t->mask + 1 - i, fp);
+            fwrite(&t->ring[0], sizeof(struct trace_rec), count - (t->mask + 1 - i), fp);
+        } else {
+            fwrite(&t->ring[i], sizeof(struct trace_rec), count, fp);
+        }
+    }
+
+    fclose(fp);
+    return (int) count;
+}
@@ -0,0 +1,107 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file trace.h
+ * @brief Per-page trace ring and log-linear latency histograms for write_pages.
+ * @date 10-17-2026
+ */
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+/* Trace ops, named as in the old DEBUG CSV */
+#define TRACE_WRITE 0     /* 'W': page written by the Sender, or by the Receiver for an ACK */
+#define TRACE_READ  1     /* 'R': page probed after the wait */
+#define TRACE_TIME  2     /* 'T': first-step write by the Tester or Receiver */
+#define TRACE_NOPS  3
+
+#define TRACE_RECORDS  (1UL << 20)   /* Ring capacity when tracing to a file */
+#define TRACE_SUB_BITS 5             /* 32 sub-buckets per power of two: ~3% resolution */
+#define TRACE_BUCKETS  (64 << TRACE_SUB_BITS)
+#define TRACE_MAGIC    "MDTRACE1"
+#define TRACE_VERSION  1
+
+struct trace_rec {
+    uint64_t ticks;           /* Write latency (timer ticks) */
+    uint32_t round;           /* write_pages call (frame, in streaming mode) */
+    uint32_t index;           /* Page */
+    uint16_t conf;            /* Classifier confidence (per mille) */
+    uint8_t op;
+    uint8_t islong;
+};
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t recsize;         /* sizeof(struct trace_rec) */
+    double ns_per_tick;
+    uint64_t count;           /* Records that follow */
+};
+
+struct trace_hist {
+    uint64_t count[TRACE_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+};
+
+struct trace {
+    struct trace_rec *ring;   /* NULL when only histograms are kept */
+    unsigned long mask;
+    volatile unsigned long head;
+    struct trace_hist hist[TRACE_NOPS];
+};
+
+int trace_init(struct trace *t, unsigned long records);
+void trace_free(struct trace *t);
+uint64_t trace_percentile(const struct trace_hist *h, unsigned int permille);
+void trace_report(const struct trace *t);
+int trace_dump(const struct trace *t, const char *path);
+
+/**
+ * trace_bucket
+ * @brief Log-linear (HDR-style) bucket: values below 2^TRACE_SUB_BITS are exact, larger
+ *        ones keep their top TRACE_SUB_BITS + 1 significant bits.
+ * @param v Value
+ * @return Bucket index
+ */
+static inline unsigned int trace_bucket(uint64_t v) {
+    unsigned int shift;
+
+    if (v < (1UL << TRACE_SUB_BITS)) {
+        return (unsigned int) v;
+    }
+
+    shift = 63 - __builtin_clzll(v) - TRACE_SUB_BITS;
+    return ((shift + 1) << TRACE_SUB_BITS) + ((v >> shift) & ((1UL << TRACE_SUB_BITS) - 1));
+}
+
+/**
+ * trace_record
+ * @brief Append one page to the ring and its op's histogram. Lock-free: a slot is claimed
+ *        with one atomic add, and the oldest records are overwritten once the ring is full.
+ */
+static inline void trace_record(struct trace *t, int op, uint32_t round, uint32_t index,
+                                uint64_t ticks, uint8_t islong, uint16_t conf) {
+    struct trace_hist *h = &t->hist[op];
+    struct trace_rec *rec;
+    uint64_t max;
+
+    __atomic_fetch_add(&h->count[trace_bucket(ticks)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (ticks > max && !__atomic_compare_exchange_n(&h->max, &max, ticks, 1,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    if (t->ring != NULL) {
+        rec = &t->ring[__atomic_fetch_add(&t->head, 1, __ATOMIC_RELAXED) & t->mask];
+        rec->ticks = ticks;
+        rec->round = round;
+        rec->index = index;
+        rec->conf = conf;
+        rec->op = (uint8_t) op;
+        rec->islong = islong;
+    }
+}
+
+#endif
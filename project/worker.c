@@ -0,0 +1,267 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file worker.c
+ * @headerfile worker.h
+ * @brief Pinned worker pool that probes disjoint page stripes in parallel.
+ * @date 10-17-2026
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "worker.h"
+#include "timer.h"
+#include "classify.h"
+
+/**
+ * worker_cpu
+ * @brief Find the n-th CPU this process may run on, so pinning respects cpusets.
+ * @param n Worker index
+ * @return CPU number, or -1 if the affinity mask is unavailable
+ */
+static int worker_cpu(int n) {
+    cpu_set_t set;
+    int cpu, ncpus, seen = 0;
+
+    if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+        return -1;
+    }
+
+    ncpus = CPU_COUNT(&set);
+    n %= ncpus;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set) && seen++ == n) {
+            return cpu;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * worker_main
+ * @brief Worker loop: pin to a CPU, then pre-fault and probe one stripe per job.
+ * @param arg The worker
+ * @return NULL
+ */
+static void *worker_main(void *arg) {
+    struct worker *w = (struct worker *) arg;
+    struct worker_pool *pool = w->pool;
+    cpu_set_t set;
+
+    if (w->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            printf("<memdupe> Warning: could not pin worker %d to cpu %d\n", w->id, w->cpu);
+        }
+    }
+
+    /* The barriers count every worker, so wait until they all exist */
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->launched && !pool->quit) {
+        pthread_cond_wait(&pool->launch, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (!pool->launched) {
+        return NULL;
+    }
+
+    for (;;) {
+        pthread_barrier_wait(&pool->start);
+        if (pool->quit) {
+            break;
+        }
+
+        if (w->count > 0) {
+            probe_prefault(pool->probe, pool->data, w->first, w->count);
+        }
+        pthread_barrier_wait(&pool->ready);
+
+        w->ticks = (w->count > 0) ? probe_stripe(pool->probe, pool->data, pool->mask, w->first, w->count) : 0;
+        pthread_barrier_wait(&pool->done);
+    }
+
+    return NULL;
+}
+
+/**
+ * worker_destroy
+ * @brief Free the synchronization and worker array once no worker is running.
+ * @param pool Pool to destroy
+ */
+static void worker_destroy(struct worker_pool *pool) {
+    pthread_barrier_destroy(&pool->start);
+    pthread_barrier_destroy(&pool->ready);
+    pthread_barrier_destroy(&pool->done);
+    pthread_cond_destroy(&pool->launch);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    pool->workers = NULL;
+}
+
+/**
+ * worker_init
+ * @brief Start a pool of workers, one per CPU, each pinned with sched_setaffinity.
+ * @param pool Pool to initialize
+ * @param nworkers Number of workers (<= 0 for one per available CPU)
+ * @return 0 on success, -1 on failure
+ */
+int worker_init(struct worker_pool *pool, int nworkers) {
+    cpu_set_t set;
+    int i;
+
+    if (nworkers <= 0) {
+        nworkers = (sched_getaffinity(0, sizeof(set), &set) == 0) ? CPU_COUNT(&set) : 1;
+    }
+
+    pool->nworkers = nworkers;
+    pool->quit = 0;
+    pool->launched = 0;
+    pool->workers = (struct worker *) calloc(nworkers, sizeof(struct worker));
+    if (pool->workers == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->launch, NULL);
+    pthread_barrier_init(&pool->start, NULL, nworkers + 1);
+    pthread_barrier_init(&pool->ready, NULL, nworkers);
+    pthread_barrier_init(&pool->done, NULL, nworkers + 1);
+
+    for (i = 0; i < nworkers; i++) {
+        pool->workers[i].id = i;
+        pool->workers[i].cpu = worker_cpu(i);
+        pool->workers[i].pool = pool;
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0) {
+            printf("<memdupe> Error starting worker %d\n", i);
+            break;
+        }
+    }
+
+    /* Release the workers into the job loop, or tell the ones started to quit */
+    pthread_mutex_lock(&pool->lock);
+    pool->launched = (i == nworkers);
+    pool->quit = !pool->launched;
+    pthread_cond_broadcast(&pool->launch);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!pool->launched) {
+        while (i > 0) {
+            pthread_join(pool->workers[--i].thread, NULL);
+        }
+        worker_destroy(pool);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * worker_free
+ * @brief Stop and join every worker.
+ * @param pool Pool to free
+ */
+void worker_free(struct worker_pool *pool) {
+    int i;
+
+    if (pool->workers == NULL) {
+        return;
+    }
+
+    pool->quit = 1;
+    pthread_barrier_wait(&pool->start);
+    for (i = 0; i < pool->nworkers; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    worker_destroy(pool);
+}
+
+/**
+ * worker_probe
+ * @brief Split the pages into word-aligned stripes and probe them on all workers at once.
+ *        Each worker fills its own slice of the shared timing array.
+ * @param pool Worker pool
+ * @param probe Probe holding the shared timing array
+ * @param data Base of the probed region
+ * @param mask Packed per-page write bits
+ * @param pages Number of pages
+ * @return Ticks spent by the slowest stripe
+ */
+uint64_t worker_probe(struct worker_pool *pool, struct probe *probe, char *data,
+                      const uint64_t *mask, unsigned long pages) {
+    unsigned long stripe, first = 0;
+    uint64_t slowest = 0;
+    int i;
+
+    stripe = (pages + pool->nworkers - 1) / pool->nworkers;
+    stripe = (stripe + WORKER_ALIGN - 1) / WORKER_ALIGN * WORKER_ALIGN;
+
+    for (i = 0; i < pool->nworkers; i++) {
+        pool->workers[i].first = first;
+        pool->workers[i].count = (first + stripe <= pages) ? stripe : pages - first;
+        first += pool->workers[i].count;
+    }
+
+    pool->probe = probe;
+    pool->data = data;
+    pool->mask = mask;
+
+    pthread_barrier_wait(&pool->start);
+    pthread_barrier_wait(&pool->done);
+
+    for (i = 0; i < pool->nworkers; i++) {
+        if (pool->workers[i].ticks > slowest) {
+            slowest = pool->workers[i].ticks;
+        }
+    }
+
+    return slowest;
+}
+
+/**
+ * worker_report
+ * @brief Compare each worker's short-write baseline against the whole pool's to expose
+ *        cross-core interference (SMT siblings, noisy neighbours, frequency differences).
+ * @param pool Worker pool
+ * @param probe Probe holding the shared timing array
+ * @param threshold Long/short boundary from the classifier (ticks)
+ * @param median Pool-wide baseline median (ticks)
+ */
+void worker_report(struct worker_pool *pool, struct probe *probe, uint64_t threshold, uint64_t median) {
+    struct worker *w;
+    uint64_t *scratch;
+    uint64_t wmedian, mad;
+    unsigned long ratio;
+    int i, nflagged = 0;
+
+    scratch = (uint64_t *) malloc(probe->pages * sizeof(uint64_t));
+    if (scratch == NULL || median == 0) {
+        free(scratch);
+        return;
+    }
+
+    for (i = 0; i < pool->nworkers; i++) {
+        w = &pool->workers[i];
+        if (w->count == 0) {
+            continue;
+        }
+
+        wmedian = class_median_mad(probe->ticks + w->first, w->count, threshold, scratch, &mad);
+        ratio = wmedian * 100 / median;
+        nflagged += (ratio >= WORKER_INTERFERENCE);
+
+        printf("<memdupe> Worker %d (cpu %d): pages %ld-%ld in %ld ns, baseline %ld ns (%ld%% of pool)%s\n",
+               w->id, w->cpu, w->first, w->first + w->count - 1, timer_to_ns(w->ticks),
+               timer_to_ns(wmedian), ratio, (ratio >= WORKER_INTERFERENCE) ? ", interference" : "");
+    }
+
+    if (nflagged > 0) {
+        printf("<memdupe> Warning: %d of %d workers saw cross-core interference\n", nflagged, pool->nworkers);
+    }
+
+    free(scratch);
+}
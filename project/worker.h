@@ -0,0 +1,54 @@
+/**
+ * @author Eddie Davis
+ * @project memdupe
+ * @file worker.h
+ * @brief Pinned worker pool that probes disjoint page stripes in parallel.
+ * @date 10-17-2026
+ */
+#ifndef _WORKER_H_
+#define _WORKER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "probe.h"
+
+#define WORKER_ALIGN        64    /* Stripe boundaries fall on whole bit vector words */
+#define WORKER_INTERFERENCE 150   /* Flag a worker whose baseline is this % of the pool's */
+
+struct worker_pool;
+
+struct worker {
+    pthread_t thread;
+    int id;
+    int cpu;                      /* CPU the worker is pinned to */
+    unsigned long first;          /* First page of the stripe */
+    unsigned long count;          /* Pages in the stripe */
+    uint64_t ticks;               /* Ticks spent on the stripe */
+    struct worker_pool *pool;
+};
+
+struct worker_pool {
+    int nworkers;
+    int quit;
+    struct worker *workers;
+    pthread_mutex_t lock;         /* Guards launched and quit until every worker exists */
+    pthread_cond_t launch;        /* Signalled once every worker exists, or on failure */
+    int launched;
+    pthread_barrier_t start;      /* Main thread + workers: a job is ready */
+    pthread_barrier_t ready;      /* Workers only: stripes pre-faulted, start timing together */
+    pthread_barrier_t done;       /* Main thread + workers: all stripes probed */
+
+    /* Current job */
+    struct probe *probe;
+    char *data;
+    const uint64_t *mask;
+};
+
+int worker_init(struct worker_pool *pool, int nworkers);
+void worker_free(struct worker_pool *pool);
+uint64_t worker_probe(struct worker_pool *pool, struct probe *probe, char *data,
+                      const uint64_t *mask, unsigned long pages);
+void worker_report(struct worker_pool *pool, struct probe *probe, uint64_t threshold, uint64_t median);
+
+#endif